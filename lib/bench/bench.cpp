@@ -0,0 +1,315 @@
+#include <benchmark/benchmark.h>
+
+#include "corpus.hpp"
+#include "../index/index.hpp"
+#include "../search/search.hpp"
+#include "../trie/term_hash.hpp"
+#include "../trie/trie.hpp"
+
+#include <sstream>
+
+namespace {
+
+CorpusOptions corpus_options;
+
+fs::path bench_dir = fs::temp_directory_path() / "search_engine_bench";
+fs::path corpus_dir = bench_dir / "corpus";
+
+// The index files are globals of the trie module, point them into the bench directory
+// so benchmarks never touch ../trash.
+void redirectIndex(const fs::path& dir) {
+    fs::create_directories(dir);
+    setIndexDir(dir.string());
+}
+
+void buildIndex() {
+    InvertedIndex ii;
+    ii.erase();
+    ii.traverse(corpus_dir);
+}
+
+// Query terms are chosen by document frequency: every document, a quarter, 2% and a single one.
+// Benchmarks take the level index, the term is resolved once the corpus is written.
+const double kDfLevels[] = {1.0, 0.25, 0.02, 0.0};
+std::vector<std::string> df_level_terms;
+
+std::string termAt(int64_t level) {
+    return df_level_terms[level];
+}
+
+void runQuery(Search& s, std::string input) {
+    std::stringstream sink;
+    std::streambuf* coutbuf = std::cout.rdbuf(sink.rdbuf());
+    s.createParser(input);
+    std::cout.rdbuf(coutbuf);
+}
+
+void BM_Tokenize(benchmark::State& state) {
+    CorpusGenerator gen(corpus_options);
+    std::string text = gen.document();
+
+    for (auto _ : state) {
+        Lexer lexer(text);
+        int64_t tokens = 0;
+        while (lexer.getNextToken().type != TokenType::END) {
+            ++tokens;
+        }
+        benchmark::DoNotOptimize(tokens);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_Tokenize);
+
+void BM_Analyze(benchmark::State& state) {
+    CorpusGenerator gen(corpus_options);
+    std::string text = gen.document();
+    AnalyzerOptions options;
+    options.flags = state.range(0);
+    Analyzer analyzer(options);
+
+    std::string term;
+    for (auto _ : state) {
+        int64_t terms = 0;
+        size_t pos = 0;
+        std::string_view token;
+        while (Analyzer::nextToken(text, pos, token)) {
+            terms += analyzer.analyze(token, term);
+        }
+        benchmark::DoNotOptimize(terms);
+    }
+    state.SetBytesProcessed(state.iterations() * text.size());
+}
+BENCHMARK(BM_Analyze)->Arg(0)->Arg(AnalyzerOptions::STOPWORDS | AnalyzerOptions::STEMMING);
+
+void BM_TrieInsert(benchmark::State& state) {
+    CorpusGenerator gen(corpus_options);
+    std::vector<std::string> words;
+    for (int64_t i = 0; i < state.range(0); ++i) {
+        words.push_back(CorpusGenerator::word(gen.nextRank()));
+    }
+
+    for (auto _ : state) {
+        Trie trie;
+        int64_t posting_list_pos = 0;
+        for (std::string& w : words) {
+            trie.insert(w, posting_list_pos++);
+        }
+        benchmark::DoNotOptimize(trie.nodesCount());
+    }
+    state.SetItemsProcessed(state.iterations() * words.size());
+}
+BENCHMARK(BM_TrieInsert)->Arg(1000)->Arg(10000);
+
+void BM_TrieFind(benchmark::State& state) {
+    CorpusGenerator gen(corpus_options);
+    Trie trie;
+    std::vector<std::string> words;
+    for (int64_t i = 0; i < 10000; ++i) {
+        words.push_back(CorpusGenerator::word(gen.nextRank()));
+        trie.insert(words.back(), i);
+    }
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(trie.find(words[i]));
+        i = (i + 1) % words.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TrieFind);
+
+void BM_TermHashFind(benchmark::State& state) {
+    CorpusGenerator gen(corpus_options);
+    std::vector<std::string> words;
+    std::vector<TermMatch> terms;
+    for (int64_t i = 0; i < 10000; ++i) {
+        words.push_back(CorpusGenerator::word(gen.nextRank()));
+        terms.push_back({words.back(), i, 0});
+    }
+    std::sort(terms.begin(), terms.end(), [](const TermMatch& a, const TermMatch& b) {
+        return a.term < b.term;
+    });
+    terms.erase(std::unique(terms.begin(), terms.end(), [](const TermMatch& a, const TermMatch& b) {
+        return a.term == b.term;
+    }), terms.end());
+    TermHash hash;
+    hash.build(terms);
+
+    size_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(hash.find(words[i]));
+        i = (i + 1) % words.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TermHashFind);
+
+// Enumeration of the terms within state.range(0) edits over a dictionary of 100000 distinct terms.
+void BM_TrieFuzzy(benchmark::State& state) {
+    Trie trie;
+    std::vector<std::string> words;
+    for (int64_t rank = 0; rank < 100000; ++rank) {
+        words.push_back(CorpusGenerator::word(rank));
+        trie.insert(words.back(), rank);
+    }
+
+    size_t i = 0;
+    for (auto _ : state) {
+        std::vector<TermMatch> terms;
+        trie.fuzzy(words[i], state.range(0), terms);
+        benchmark::DoNotOptimize(terms.size());
+        i = (i + 7919) % words.size();
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_TrieFuzzy)->DenseRange(1, 2)->Unit(benchmark::kMicrosecond);
+
+void BM_Traverse(benchmark::State& state) {
+    int64_t bytes = 0;
+    for (const auto& entry : fs::directory_iterator(corpus_dir)) {
+        bytes += entry.file_size();
+    }
+
+    for (auto _ : state) {
+        buildIndex();
+    }
+    state.SetBytesProcessed(state.iterations() * bytes);
+    state.counters["docs/s"] = benchmark::Counter(state.iterations() * corpus_options.docs, benchmark::Counter::kIsRate);
+}
+BENCHMARK(BM_Traverse)->Unit(benchmark::kMillisecond)->Iterations(3);
+
+void BM_IndexOpen(benchmark::State& state) {
+    for (auto _ : state) {
+        Search s;
+        s.open();
+        benchmark::DoNotOptimize(&s);
+    }
+}
+BENCHMARK(BM_IndexOpen)->Unit(benchmark::kMicrosecond);
+
+// The query benchmarks measure evaluation, so the caches kept between queries are disabled.
+void uncached(Search& s) {
+    s.chooseK(10);
+    s.setResultCacheSize(0);
+    s.setBlockCacheSize(0);
+}
+
+void BM_SingleTerm(benchmark::State& state) {
+    Search s;
+    uncached(s);
+    std::string input = termAt(state.range(0));
+
+    for (auto _ : state) {
+        runQuery(s, input);
+    }
+}
+BENCHMARK(BM_SingleTerm)->DenseRange(0, 3)->Unit(benchmark::kMicrosecond);
+
+void BM_And(benchmark::State& state) {
+    Search s;
+    uncached(s);
+    std::string input = termAt(state.range(0)) + " AND " + termAt(state.range(1));
+
+    for (auto _ : state) {
+        runQuery(s, input);
+    }
+}
+BENCHMARK(BM_And)->ArgsProduct({{0, 1}, {2, 3}})->Unit(benchmark::kMicrosecond);
+
+void BM_Or(benchmark::State& state) {
+    Search s;
+    uncached(s);
+    std::string input = termAt(state.range(0)) + " OR " + termAt(state.range(1));
+
+    for (auto _ : state) {
+        runQuery(s, input);
+    }
+}
+BENCHMARK(BM_Or)->ArgsProduct({{0, 1}, {2, 3}})->Unit(benchmark::kMicrosecond);
+
+// A wide OR query scored by the cursors (0) and term at a time (1).
+void BM_OrEvaluation(benchmark::State& state) {
+    Search s;
+    uncached(s);
+    s.chooseEvaluation(state.range(0) == 0 ? Evaluation::DOCUMENT_AT_A_TIME : Evaluation::TERM_AT_A_TIME);
+    std::string input = termAt(0) + " OR " + termAt(1) + " OR " + termAt(2) + " OR " + termAt(3);
+
+    for (auto _ : state) {
+        runQuery(s, input);
+    }
+}
+BENCHMARK(BM_OrEvaluation)->DenseRange(0, 1)->Unit(benchmark::kMicrosecond);
+
+// The same OR query over and over: with the block cache only (0) and with the result cache too (1).
+void BM_RepeatedQuery(benchmark::State& state) {
+    Search s;
+    s.chooseK(10);
+    if (state.range(0) == 0) {
+        s.setResultCacheSize(0);
+    }
+    std::string input = termAt(0) + " OR " + termAt(2);
+
+    for (auto _ : state) {
+        runQuery(s, input);
+    }
+    state.counters["block_hit_rate"] = static_cast<double>(s.blockCache().hits()) /
+                                       std::max<int64_t>(1, s.blockCache().hits() + s.blockCache().misses());
+}
+BENCHMARK(BM_RepeatedQuery)->DenseRange(0, 1)->Unit(benchmark::kMicrosecond);
+
+bool parseCorpusFlag(const std::string& arg) {
+    auto value = [&arg](const char* name, int64_t& out) {
+        std::string prefix = std::string(name) + "=";
+        if (arg.rfind(prefix, 0) != 0) {
+            return false;
+        }
+        out = std::stoll(arg.substr(prefix.size()));
+        return true;
+    };
+
+    int64_t seed;
+    if (value("--corpus_seed", seed)) {
+        corpus_options.seed = seed;
+        return true;
+    }
+    return value("--corpus_docs", corpus_options.docs) || value("--corpus_doc_length", corpus_options.doc_length)
+           || value("--corpus_vocabulary", corpus_options.vocabulary);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::vector<char*> rest;
+    for (int i = 0; i < argc; ++i) {
+        if (i == 0 || !parseCorpusFlag(argv[i])) {
+            rest.push_back(argv[i]);
+        }
+    }
+    int rest_count = rest.size();
+
+    redirectIndex(bench_dir / "index");
+    CorpusGenerator corpus(corpus_options);
+    corpus.write(corpus_dir);
+    std::string terms;
+    for (double level : kDfLevels) {
+        df_level_terms.push_back(CorpusGenerator::word(corpus.rankWithDf(std::max<int64_t>(1, level * corpus_options.docs))));
+        terms += (terms.empty() ? "" : " ") + df_level_terms.back();
+    }
+
+    benchmark::AddCustomContext("corpus_docs", std::to_string(corpus_options.docs));
+    benchmark::AddCustomContext("corpus_doc_length", std::to_string(corpus_options.doc_length));
+    benchmark::AddCustomContext("corpus_vocabulary", std::to_string(corpus_options.vocabulary));
+    benchmark::AddCustomContext("corpus_seed", std::to_string(corpus_options.seed));
+    benchmark::AddCustomContext("df_level_terms", terms);
+
+    benchmark::Initialize(&rest_count, rest.data());
+    if (benchmark::ReportUnrecognizedArguments(rest_count, rest.data())) {
+        return EXIT_FAILURE;
+    }
+
+    buildIndex();
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    fs::remove_all(bench_dir);
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace fs = std::filesystem;
+
+struct CorpusOptions {
+    int64_t docs = 200;
+    int64_t doc_length = 300;
+    int64_t words_per_line = 12;
+    int64_t vocabulary = 5000;
+    double zipf_s = 1.0;
+    uint64_t seed = 42;
+};
+
+// Deterministic Zipf corpus: term of rank r is drawn with probability ~ 1 / (r + 1)^s.
+// Only the raw output of mt19937_64 is used, which the standard fully specifies,
+// so the same options produce byte-identical corpora on every platform and commit.
+class CorpusGenerator {
+public:
+    explicit CorpusGenerator(const CorpusOptions& options) : options_(options), rng_(options.seed) {
+        cdf_.resize(options_.vocabulary);
+        df_.assign(options_.vocabulary, 0);
+        double sum = 0.0;
+        for (int64_t r = 0; r < options_.vocabulary; ++r) {
+            sum += 1.0 / std::pow(static_cast<double>(r + 1), options_.zipf_s);
+            cdf_[r] = sum;
+        }
+        for (double& x : cdf_) {
+            x /= sum;
+        }
+    }
+
+    // Lowercase word of rank r, distinct for every rank.
+    static std::string word(int64_t rank) {
+        std::string rez;
+        int64_t x = rank;
+        do {
+            rez.push_back(static_cast<char>('a' + x % 26));
+            x /= 26;
+        } while (x > 0);
+
+        return rez;
+    }
+
+    int64_t nextRank() {
+        double u = static_cast<double>(rng_() >> 11) * (1.0 / 9007199254740992.0);
+        int64_t lo = 0;
+        int64_t hi = options_.vocabulary - 1;
+        while (lo < hi) {
+            int64_t mid = (lo + hi) / 2;
+            if (cdf_[mid] < u) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        return lo;
+    }
+
+    std::string document() {
+        std::string rez;
+        std::vector<int64_t> ranks;
+        for (int64_t i = 0; i < options_.doc_length; ++i) {
+            ranks.push_back(nextRank());
+            rez += word(ranks.back());
+            rez.push_back((i + 1) % options_.words_per_line == 0 ? '\n' : ' ');
+        }
+
+        std::sort(ranks.begin(), ranks.end());
+        ranks.erase(std::unique(ranks.begin(), ranks.end()), ranks.end());
+        for (int64_t r : ranks) {
+            ++df_[r];
+        }
+
+        return rez;
+    }
+
+    // Writes docs as 000000.txt, 000001.txt, ... into dir, replacing what was there.
+    void write(const fs::path& dir) {
+        fs::remove_all(dir);
+        fs::create_directories(dir);
+        df_.assign(options_.vocabulary, 0);
+        for (int64_t d = 0; d < options_.docs; ++d) {
+            std::string name = std::to_string(d);
+            name.insert(0, 6 - std::min<size_t>(6, name.size()), '0');
+            std::ofstream out(dir / (name + ".txt"), std::ios::binary);
+            out << document();
+        }
+    }
+
+    // Rank of the term whose document frequency in the written corpus is closest to df.
+    int64_t rankWithDf(int64_t df) const {
+        int64_t best = 0;
+        for (int64_t r = 0; r < static_cast<int64_t>(df_.size()); ++r) {
+            if (df_[r] > 0 && std::abs(df_[r] - df) < std::abs(df_[best] - df)) {
+                best = r;
+            }
+        }
+
+        return best;
+    }
+
+private:
+    CorpusOptions options_;
+    std::vector<int64_t> df_;
+    std::mt19937_64 rng_;
+    std::vector<double> cdf_;
+};
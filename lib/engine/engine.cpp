@@ -0,0 +1 @@
+#include "engine.hpp"
@@ -0,0 +1,227 @@
+#pragma once
+#include "../search/search.hpp"
+#include "../trie/errors.hpp"
+
+#include <concepts>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// A document found by a query: its id, path, score, the numbers of the lines the query terms are on and
+// the paths of its duplicates.
+struct QueryHit {
+    int64_t doc;
+    std::string path;
+    double score;
+    std::vector<int64_t> lines;
+    std::vector<std::string> duplicates;
+};
+
+// The hits of a query in the order the search displays them, or the error that stopped it.
+struct QueryResults {
+    std::vector<QueryHit> hits;
+    std::vector<std::string> warnings;
+    std::string error;
+
+    bool ok() const {
+        return error.empty();
+    }
+};
+
+struct IndexOptions {
+    int64_t max_expansions = 1024;
+    IoBackend io = IoBackend::AUTO;
+    int64_t result_cache_bytes = defaultResultCacheBytes;
+    int64_t block_cache_bytes = defaultBlockCacheBytes;
+};
+
+// Anything running a task later on a thread of its own: the post of an event loop, a thread pool.
+template <typename E>
+concept Executor = requires(E& executor, std::function<void()> task) { executor(std::move(task)); };
+
+// The engine for a program embedding it: the index in a directory written by ./index, searched from
+// any number of threads. Nothing is printed and no error ends the process, errors are returned.
+//
+// Every running query has a Search of its own, taken from a pool of idle ones, so concurrent queries
+// do not wait for each other. The Searches share the opened generation of the index with its dictionary
+// and caches; a newly published generation is opened once and picked up by every Search on its next query.
+class Index {
+public:
+    Index() : open_(false), running_(0) {}
+
+    ~Index() {
+        close();
+    }
+
+    Index(const Index&) = delete;
+    Index& operator=(const Index&) = delete;
+
+    // The error, empty when the index was opened.
+    std::string open(const std::string& dir, IndexOptions options = {}) {
+        close();
+        std::shared_ptr<IndexSnapshots> snapshots = std::make_shared<IndexSnapshots>(dir);
+        std::unique_ptr<Search> search;
+        try {
+            ThrowEngineErrors errors;
+            snapshots->setResultCacheSize(options.result_cache_bytes);
+            snapshots->setBlockCacheSize(options.block_cache_bytes);
+            snapshots->open();
+            search = create(snapshots, options);
+        } catch (const std::exception& e) {
+            return e.what();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        snapshots_ = snapshots;
+        options_ = options;
+        idle_.push_back(std::move(search));
+        open_ = true;
+
+        return "";
+    }
+
+    // Waits for the running queries, the ones started after it fail.
+    void close() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        open_ = false;
+        finished_.wait(lock, [this] { return running_ == 0; });
+        idle_.clear();
+        snapshots_.reset();
+    }
+
+    bool isOpen() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return open_;
+    }
+
+    QueryResults search(const std::string& query, int64_t k) {
+        QueryResults rez;
+        std::unique_ptr<Search> search = acquire(rez.error);
+        if (search == nullptr) {
+            return rez;
+        }
+        try {
+            ThrowEngineErrors errors;
+            search->chooseK(k);
+            std::string input = query;
+            search->createParser(input);
+            for (const SearchResult& result : search->results()) {
+                rez.hits.push_back({result.doc, result.path, result.score, result.lines, result.duplicates});
+            }
+            rez.warnings = search->warnings();
+        } catch (const std::exception& e) {
+            rez.error = e.what();
+        }
+        release(std::move(search));
+
+        return rez;
+    }
+
+    // Runs the query on the executor, the future gets its results.
+    template <Executor E>
+    std::future<QueryResults> searchAsync(std::string query, int64_t k, E& executor) {
+        auto promise = std::make_shared<std::promise<QueryResults> >();
+        std::future<QueryResults> rez = promise->get_future();
+        executor([this, promise, query = std::move(query), k] {
+            promise->set_value(search(query, k));
+        });
+
+        return rez;
+    }
+
+    // co_await index.awaitSearch(query, k, executor) suspends the coroutine while the query runs on
+    // the executor and resumes it there with the results, no thread waits for the query.
+    template <Executor E>
+    class SearchAwaiter {
+    public:
+        SearchAwaiter(Index& index, std::string query, int64_t k, E& executor)
+            : index_(index), query_(std::move(query)), k_(k), executor_(executor) {}
+
+        bool await_ready() const noexcept {
+            return false;
+        }
+
+        void await_suspend(std::coroutine_handle<> handle) {
+            executor_([this, handle] {
+                results_ = index_.search(query_, k_);
+                handle.resume();
+            });
+        }
+
+        QueryResults await_resume() {
+            return std::move(results_);
+        }
+
+    private:
+        Index& index_;
+        std::string query_;
+        int64_t k_;
+        E& executor_;
+        QueryResults results_;
+    };
+
+    template <Executor E>
+    SearchAwaiter<E> awaitSearch(std::string query, int64_t k, E& executor) {
+        return SearchAwaiter<E>(*this, std::move(query), k, executor);
+    }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable finished_;
+    bool open_;
+    int64_t running_;
+    std::shared_ptr<IndexSnapshots> snapshots_;
+    IndexOptions options_;
+    std::vector<std::unique_ptr<Search> > idle_;
+
+    static std::unique_ptr<Search> create(std::shared_ptr<IndexSnapshots> snapshots, const IndexOptions& options) {
+        ThrowEngineErrors errors;
+        std::unique_ptr<Search> search(new Search());
+        search->shareSnapshots(std::move(snapshots));
+        search->printResults(false);
+        search->printWarnings(false);
+        search->chooseMaxExpansions(options.max_expansions);
+        search->chooseIo(options.io);
+
+        return search;
+    }
+
+    std::unique_ptr<Search> acquire(std::string& error) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!open_) {
+            error = "index is not open";
+            return nullptr;
+        }
+        ++running_;
+        if (!idle_.empty()) {
+            std::unique_ptr<Search> search = std::move(idle_.back());
+            idle_.pop_back();
+            return search;
+        }
+        std::shared_ptr<IndexSnapshots> snapshots = snapshots_;
+        IndexOptions options = options_;
+        lock.unlock();
+        try {
+            return create(snapshots, options);
+        } catch (const std::exception& e) {
+            error = e.what();
+            release(nullptr);
+            return nullptr;
+        }
+    }
+
+    void release(std::unique_ptr<Search> search) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (open_ && search != nullptr) {
+            idle_.push_back(std::move(search));
+        }
+        --running_;
+        finished_.notify_all();
+    }
+};
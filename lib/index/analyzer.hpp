@@ -0,0 +1,247 @@
+#pragma once
+#include "../trie/trie.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+
+// Which optional stages run after case folding. The indexer saves them in analyzer.txt as an int64
+// of flags, so the query side analyzes its terms the way the documents were analyzed.
+struct AnalyzerOptions {
+    static const int64_t STOPWORDS = 1;
+    static const int64_t STEMMING = 2;
+
+    int64_t flags = 0;
+
+    bool stopwords() const {
+        return flags & STOPWORDS;
+    }
+
+    bool stemming() const {
+        return flags & STEMMING;
+    }
+
+    void save() const {
+        std::ofstream out(analyzer_p, std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&flags), sizeof(int64_t));
+    }
+
+    // An index without the file was written with the defaults.
+    static AnalyzerOptions load(const std::string& path = analyzer_p) {
+        AnalyzerOptions options;
+        std::ifstream in(path, std::ios::binary);
+        if (!in.read(reinterpret_cast<char*>(&options.flags), sizeof(int64_t))) {
+            options.flags = 0;
+        }
+
+        return options;
+    }
+};
+
+// Lowercases ASCII bytes in place and folds the upper case letters of Latin-1, Latin Extended-A, Greek
+// and Cyrillic. Tokens without multibyte characters, most of them, only take the ASCII loop.
+struct CaseFold {
+    static void apply(std::string_view token, std::string& out) {
+        out.assign(token);
+        bool ascii = true;
+        for (char& c : out) {
+            unsigned char b = c;
+            if (b >= 0x80) {
+                ascii = false;
+            } else if (b >= 'A' && b <= 'Z') {
+                c = b + ('a' - 'A');
+            }
+        }
+        if (!ascii) {
+            foldMultibyte(out);
+        }
+    }
+
+    // The folded letters have the length of their upper case forms, so they are rewritten in place.
+    static void foldMultibyte(std::string& term) {
+        for (size_t i = 0; i < term.size();) {
+            size_t len = 0;
+            uint32_t cp = decode(term, i, len);
+            uint32_t folded = lower(cp);
+            if (folded != cp && len == 2) {
+                encode(folded, &term[i]);
+            }
+            i += len;
+        }
+    }
+
+    static uint32_t lower(uint32_t cp) {
+        if ((cp >= 0xC0 && cp <= 0xDE && cp != 0xD7) || (cp >= 0x391 && cp <= 0x3AB && cp != 0x3A2) ||
+            (cp >= 0x410 && cp <= 0x42F)) {
+            return cp + 0x20;
+        }
+        if (cp >= 0x400 && cp <= 0x40F) {
+            return cp + 0x50;
+        }
+        if ((cp >= 0x100 && cp <= 0x137) || (cp >= 0x14A && cp <= 0x177)) {
+            return cp | 1;
+        }
+        if ((cp >= 0x139 && cp <= 0x148) || (cp >= 0x179 && cp <= 0x17E)) {
+            return (cp & 1) ? cp + 1 : cp;
+        }
+
+        return cp;
+    }
+
+    static const uint32_t invalid = 0xFFFFFFFF;
+
+    // The code point at i, len is its length in bytes; a malformed byte is 1 byte long and invalid.
+    static uint32_t decode(std::string_view text, size_t i, size_t& len) {
+        unsigned char b = text[i];
+        len = b < 0x80 ? 1 : (b >> 5) == 0x6 ? 2 : (b >> 4) == 0xE ? 3 : (b >> 3) == 0x1E ? 4 : 0;
+        if (len == 0 || i + len > text.size()) {
+            len = 1;
+            return invalid;
+        }
+        uint32_t cp = len == 1 ? b : b & (0xFF >> (len + 1));
+        for (size_t k = 1; k < len; ++k) {
+            unsigned char cont = text[i + k];
+            if ((cont >> 6) != 0x2) {
+                len = 1;
+                return invalid;
+            }
+            cp = (cp << 6) | (cont & 0x3F);
+        }
+
+        return cp;
+    }
+
+    // Only called for the 2 byte letters lower() folds.
+    static void encode(uint32_t cp, char* out) {
+        out[0] = 0xC0 | (cp >> 6);
+        out[1] = 0x80 | (cp & 0x3F);
+    }
+};
+
+// Drops the most frequent English function words, which are in almost every document.
+struct StopwordFilter {
+    static bool apply(std::string& term) {
+        return !isStopword(term);
+    }
+
+    static bool isStopword(std::string_view term) {
+        if (term.size() > 5) {
+            return false;
+        }
+        static const std::string_view words[] = {
+            "a",    "an",    "and",   "are",  "as",    "at",    "be",   "but",  "by",   "for",  "if",
+            "in",   "into",  "is",    "it",   "no",    "not",   "of",   "on",   "or",   "such", "that",
+            "the",  "their", "then",  "there", "these", "they", "this", "to",   "was",  "will", "with",
+        };
+
+        return std::binary_search(std::begin(words), std::end(words), term);
+    }
+};
+
+// The S-stemmer: conflates English plurals, "-ies" -> "-y", "-es" -> "-e", "-s" -> "", leaving short
+// words and the endings that are not plurals ("-ss", "-us", "-aes", ...) alone.
+struct LightStemmer {
+    static bool apply(std::string& term) {
+        std::string_view t = term;
+        if (t.size() <= 3) {
+            return true;
+        }
+        if (t.ends_with("ies") && !t.ends_with("eies") && !t.ends_with("aies")) {
+            term.replace(term.size() - 3, 3, "y");
+        } else if (t.ends_with("es") && !t.ends_with("aes") && !t.ends_with("ees") && !t.ends_with("oes")) {
+            term.pop_back();
+        } else if (t.ends_with("s") && !t.ends_with("us") && !t.ends_with("ss")) {
+            term.pop_back();
+        }
+
+        return true;
+    }
+};
+
+// Case folding followed by the filters, combined at compile time; a filter returning false drops the term.
+template <typename... Stages>
+struct AnalyzerPipeline {
+    static bool run(std::string_view token, std::string& out) {
+        CaseFold::apply(token, out);
+
+        return (Stages::apply(out) && ...);
+    }
+};
+
+// The tokenizer and term normalization shared by the indexer and the query lexer. A token is a maximal
+// run of letters: ASCII letters and the multibyte characters outside the punctuation and symbol blocks.
+// Tokens are spans of the input and terms are written into a buffer owned by the caller, so a caller
+// reusing its buffer analyzes a document without allocating.
+class Analyzer {
+public:
+    explicit Analyzer(AnalyzerOptions options = {}) : options_(options) {
+        if (options.stopwords() && options.stemming()) {
+            run_ = &AnalyzerPipeline<StopwordFilter, LightStemmer>::run;
+        } else if (options.stopwords()) {
+            run_ = &AnalyzerPipeline<StopwordFilter>::run;
+        } else if (options.stemming()) {
+            run_ = &AnalyzerPipeline<LightStemmer>::run;
+        } else {
+            run_ = &AnalyzerPipeline<>::run;
+        }
+    }
+
+    const AnalyzerOptions& options() const {
+        return options_;
+    }
+
+    // Bytes of the letter at text[i], 0 when it is not a letter.
+    static size_t letterLength(std::string_view text, size_t i) {
+        unsigned char b = text[i];
+        if (b < 0x80) {
+            return (b >= 'a' && b <= 'z') || (b >= 'A' && b <= 'Z') ? 1 : 0;
+        }
+        size_t len = 0;
+        uint32_t cp = CaseFold::decode(text, i, len);
+        if (cp == CaseFold::invalid || cp < 0x80 || (cp >= 0x80 && cp <= 0xBF && cp != 0xAA && cp != 0xB5 && cp != 0xBA) || cp == 0xD7 ||
+            cp == 0xF7 || (cp >= 0x2000 && cp <= 0x2BFF) || (cp >= 0x3000 && cp <= 0x303F) || (cp >= 0xFE30 && cp <= 0xFE4F) ||
+            (cp >= 0xFF00 && cp <= 0xFF0F)) {
+            return 0;
+        }
+
+        return len;
+    }
+
+    // The next token at or after pos, pos is moved past it; false at the end of the text.
+    static bool nextToken(std::string_view text, size_t& pos, std::string_view& token) {
+        size_t len = 0;
+        while (pos < text.size() && (len = letterLength(text, pos)) == 0) {
+            ++pos;
+        }
+        if (pos == text.size()) {
+            return false;
+        }
+        size_t begin = pos;
+        do {
+            pos += len;
+        } while (pos < text.size() && (len = letterLength(text, pos)) != 0);
+        token = text.substr(begin, pos - begin);
+
+        return true;
+    }
+
+    // Writes the term of the token into out, false when the token is dropped.
+    bool analyze(std::string_view token, std::string& out) const {
+        return run_(token, out);
+    }
+
+    // Only case folding, for the wildcard and fuzzy terms of a query, which are not whole words.
+    static void fold(std::string_view token, std::string& out) {
+        CaseFold::apply(token, out);
+    }
+
+    bool isStopword(std::string_view term) const {
+        return options_.stopwords() && StopwordFilter::isStopword(term);
+    }
+
+private:
+    AnalyzerOptions options_;
+    bool (*run_)(std::string_view, std::string&);
+};
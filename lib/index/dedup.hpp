@@ -0,0 +1,221 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <map>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Near duplicate documents are found by MinHash over the shingles of their terms, 3 consecutive terms
+// each: the share of equal minimums of two signatures estimates the Jaccard similarity of their shingle
+// sets. The signature is split into bands, two documents sharing a band are candidates, so a document
+// is compared only to the few earlier ones it is likely similar to (LSH).
+const int64_t minHashes = 64;
+const int64_t lshBands = 16;
+const int64_t shingleTerms = 3;
+
+inline uint64_t mixHash(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+
+    return x ^ (x >> 31);
+}
+
+inline uint64_t fnv1a(std::string_view bytes) {
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    for (char c : bytes) {
+        hash = (hash ^ static_cast<unsigned char>(c)) * 0x100000001B3ULL;
+    }
+
+    return hash;
+}
+
+// Built term by term while a document is tokenized.
+class DocumentSignature {
+public:
+    DocumentSignature() {
+        reset();
+    }
+
+    void reset() {
+        minimums_.fill(UINT32_MAX);
+        recent_.fill(0);
+        terms_ = 0;
+    }
+
+    void add(std::string_view term) {
+        recent_[terms_ % shingleTerms] = fnv1a(term);
+        ++terms_;
+        uint64_t shingle = 0;
+        for (int64_t i = std::max<int64_t>(0, terms_ - shingleTerms); i < terms_; ++i) {
+            shingle = mixHash(shingle ^ recent_[i % shingleTerms]);
+        }
+        for (int64_t i = 0; i < minHashes; ++i) {
+            uint32_t value = static_cast<uint32_t>(mixHash(shingle + i * 0x632BE59BD9B4E019ULL) >> 32);
+            minimums_[i] = std::min(minimums_[i], value);
+        }
+    }
+
+    int64_t terms() const {
+        return terms_;
+    }
+
+    const std::array<uint32_t, minHashes>& minimums() const {
+        return minimums_;
+    }
+
+private:
+    std::array<uint32_t, minHashes> minimums_;
+    std::array<uint64_t, shingleTerms> recent_;
+    int64_t terms_;
+};
+
+// Remembers the indexed documents and finds for a new one the earlier document it duplicates: one with
+// the same bytes, or one whose estimated similarity is at least the threshold. Every indexed document
+// costs its signature, minHashes * 4 bytes, and its band keys.
+class DuplicateDetector {
+public:
+    explicit DuplicateDetector(double threshold = 0.9) : threshold_(threshold) {}
+
+    // The earlier document duplicated by this one, or -1 after remembering it as doc.
+    int64_t find(std::string_view content, const DocumentSignature& signature, int64_t doc) {
+        uint64_t content_hash = fnv1a(content) ^ mixHash(content.size());
+        auto exact = exact_.find(content_hash);
+        if (exact != exact_.end()) {
+            return exact->second;
+        }
+
+        std::array<uint64_t, lshBands> keys;
+        const int64_t rows = minHashes / lshBands;
+        for (int64_t band = 0; band < lshBands; ++band) {
+            uint64_t key = mixHash(band);
+            for (int64_t row = 0; row < rows; ++row) {
+                key = mixHash(key ^ signature.minimums()[band * rows + row]);
+            }
+            keys[band] = key;
+        }
+        if (signature.terms() > 0) {
+            for (int64_t band = 0; band < lshBands; ++band) {
+                auto candidates = bands_.equal_range(keys[band]);
+                for (auto it = candidates.first; it != candidates.second; ++it) {
+                    if (similarity(signature, it->second) >= threshold_) {
+                        return it->second;
+                    }
+                }
+            }
+        }
+
+        exact_.emplace(content_hash, doc);
+        if (signature.terms() > 0) {
+            for (int64_t band = 0; band < lshBands; ++band) {
+                bands_.emplace(keys[band], doc);
+            }
+        }
+        signatures_.push_back(signature.minimums());
+
+        return -1;
+    }
+
+private:
+    double threshold_;
+    std::unordered_map<uint64_t, int64_t> exact_;
+    std::unordered_multimap<uint64_t, int64_t> bands_;
+    // By document, the documents are numbered in the order they are remembered.
+    std::vector<std::array<uint32_t, minHashes> > signatures_;
+
+    double similarity(const DocumentSignature& signature, int64_t doc) const {
+        const auto& other = signatures_[doc];
+        int64_t equal = 0;
+        for (int64_t i = 0; i < minHashes; ++i) {
+            equal += signature.minimums()[i] == other[i];
+        }
+
+        return static_cast<double>(equal) / minHashes;
+    }
+};
+
+// duplicates.txt maps the path of an indexed document to the paths of the documents left out of the index
+// as its duplicates, so the results still list every copy. Keyed by path, it stays valid when the documents
+// are renumbered. File format: int64 groups count, then every group as its path, int64 duplicates count and
+// their paths, a path as int64 length and bytes.
+class DuplicateMap {
+public:
+    void add(const std::string& path, const std::string& duplicate) {
+        groups_[path].push_back(duplicate);
+    }
+
+    bool empty() const {
+        return groups_.empty();
+    }
+
+    int64_t duplicates() const {
+        int64_t rez = 0;
+        for (const auto& [path, duplicates] : groups_) {
+            rez += duplicates.size();
+        }
+
+        return rez;
+    }
+
+    void write(const char* file) const {
+        std::ofstream out(file, std::ios::binary | std::ios::trunc);
+        int64_t count = groups_.size();
+        out.write(reinterpret_cast<const char*>(&count), sizeof(int64_t));
+        for (const auto& [path, duplicates] : groups_) {
+            writeString(out, path);
+            count = duplicates.size();
+            out.write(reinterpret_cast<const char*>(&count), sizeof(int64_t));
+            for (const std::string& duplicate : duplicates) {
+                writeString(out, duplicate);
+            }
+        }
+    }
+
+    // An index without the file has no duplicates.
+    void read(const std::string& file) {
+        groups_.clear();
+        std::ifstream in(file, std::ios::binary);
+        int64_t groups = 0;
+        if (!in.read(reinterpret_cast<char*>(&groups), sizeof(int64_t))) {
+            return;
+        }
+        for (int64_t i = 0; i < groups && in; ++i) {
+            std::string path = readString(in);
+            int64_t count = 0;
+            in.read(reinterpret_cast<char*>(&count), sizeof(int64_t));
+            std::vector<std::string>& duplicates = groups_[path];
+            for (int64_t j = 0; j < count && in; ++j) {
+                duplicates.push_back(readString(in));
+            }
+        }
+    }
+
+    const std::vector<std::string>* find(const std::string& path) const {
+        auto it = groups_.find(path);
+
+        return it == groups_.end() ? nullptr : &it->second;
+    }
+
+private:
+    std::map<std::string, std::vector<std::string> > groups_;
+
+    static void writeString(std::ofstream& out, const std::string& value) {
+        int64_t size = value.size();
+        out.write(reinterpret_cast<const char*>(&size), sizeof(int64_t));
+        out.write(value.data(), size);
+    }
+
+    static std::string readString(std::ifstream& in) {
+        int64_t size = 0;
+        in.read(reinterpret_cast<char*>(&size), sizeof(int64_t));
+        std::string rez(std::max<int64_t>(0, size), '\0');
+        in.read(rez.data(), rez.size());
+
+        return rez;
+    }
+};
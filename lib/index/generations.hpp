@@ -0,0 +1,162 @@
+#pragma once
+#include "../trie/trie.hpp"
+#include "../trie/errors.hpp"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+
+// Every run of ./index writes a complete index into a fresh <root>/gen/<N> and then publishes it by
+// renaming <root>/CURRENT.tmp, holding the int64 N, over <root>/CURRENT. A searcher reading CURRENT
+// sees either the old or the new generation, never a half written one. Without CURRENT the index
+// files are read from the root itself, the layout of the tests and of older indexes.
+class IndexGenerations {
+public:
+    // Generations kept on disk besides the current one, for the searchers still reading them.
+    static const int64_t kept = 1;
+
+    explicit IndexGenerations(std::filesystem::path root) : root_(std::move(root)) {}
+
+    // Next to the index files the globals point to.
+    static IndexGenerations fromIndexDir() {
+        return IndexGenerations(std::filesystem::path(trie_p).parent_path());
+    }
+
+    const std::filesystem::path& root() const {
+        return root_;
+    }
+
+    // The published generation, -1 when none was published.
+    int64_t current() const {
+        std::ifstream in(root_ / "CURRENT", std::ios::binary);
+        int64_t generation = -1;
+        if (!in.read(reinterpret_cast<char*>(&generation), sizeof(int64_t))) {
+            return -1;
+        }
+
+        return generation;
+    }
+
+    std::string dir(int64_t generation) const {
+        return (root_ / "gen" / std::to_string(generation)).string();
+    }
+
+    // Directory of the published index files.
+    std::string currentDir() const {
+        int64_t generation = current();
+
+        return generation == -1 ? root_.string() : dir(generation);
+    }
+
+    // Past every generation on disk, so a build never reuses a directory a searcher may still read.
+    int64_t next() const {
+        int64_t rez = current() + 1;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(root_ / "gen", ec)) {
+            char* end = nullptr;
+            std::string name = entry.path().filename().string();
+            int64_t generation = std::strtoll(name.c_str(), &end, 10);
+            if (*end == '\0' && generation >= rez) {
+                rez = generation + 1;
+            }
+        }
+
+        return rez;
+    }
+
+    // The files of the generation reach the disk before CURRENT names it.
+    void publish(int64_t generation) const {
+        for (const auto& entry : std::filesystem::recursive_directory_iterator(dir(generation))) {
+            if (entry.is_regular_file()) {
+                sync(entry.path(), O_RDONLY);
+            } else if (entry.is_directory()) {
+                sync(entry.path(), O_RDONLY | O_DIRECTORY);
+            }
+        }
+        sync(dir(generation), O_RDONLY | O_DIRECTORY);
+        std::string tmp = (root_ / "CURRENT.tmp").string();
+        int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || ::write(fd, &generation, sizeof(int64_t)) != sizeof(int64_t) || fsync(fd) != 0) {
+            fail("can not write " + tmp);
+        }
+        ::close(fd);
+        if (std::rename(tmp.c_str(), (root_ / "CURRENT").c_str()) != 0) {
+            fail("can not publish generation " + std::to_string(generation));
+        }
+        sync(root_, O_RDONLY | O_DIRECTORY);
+    }
+
+    // Removes the generations older than the kept ones before the current, except those a searcher
+    // still reads; they go with a later prune.
+    void prune() const {
+        int64_t oldest = current() - kept;
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(root_ / "gen", ec)) {
+            char* end = nullptr;
+            std::string name = entry.path().filename().string();
+            int64_t generation = std::strtoll(name.c_str(), &end, 10);
+            if (*end != '\0' || generation >= oldest) {
+                continue;
+            }
+            // Held while the files are removed, so no searcher locks the generation meanwhile.
+            int fd = ::open(lockFile(entry.path()).c_str(), O_RDONLY);
+            if (fd >= 0 && flock(fd, LOCK_EX | LOCK_NB) != 0) {
+                ::close(fd);
+                continue;
+            }
+            std::filesystem::remove_all(entry.path(), ec);
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+    }
+
+    // The file of the index files in dir locked by their readers, see GenerationLock.
+    static std::string lockFile(const std::filesystem::path& dir) {
+        return (dir / std::filesystem::path(trie_p).filename()).string();
+    }
+
+private:
+    std::filesystem::path root_;
+
+    static void sync(const std::filesystem::path& path, int flags) {
+        int fd = ::open(path.c_str(), flags);
+        if (fd >= 0) {
+            fsync(fd);
+            ::close(fd);
+        }
+    }
+};
+
+// A shared lock on the index files in a directory, held by a searcher for as long as it reads them:
+// IndexGenerations::prune leaves a locked generation on disk. It is an flock, so it is also released
+// when the process holding it ends.
+class GenerationLock {
+public:
+    explicit GenerationLock(const std::string& dir) : fd_(::open(IndexGenerations::lockFile(dir).c_str(), O_RDONLY)) {
+        if (fd_ >= 0) {
+            flock(fd_, LOCK_SH);
+        }
+    }
+
+    ~GenerationLock() {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    GenerationLock(const GenerationLock&) = delete;
+    GenerationLock& operator=(const GenerationLock&) = delete;
+
+private:
+    int fd_;
+};
@@ -1,25 +1,33 @@
 #pragma once
+#include "../trie/term_hash.hpp"
+#include "../trie/errors.hpp"
+#include "analyzer.hpp"
+#include "dedup.hpp"
+#include "paths.hpp"
 #include "../trie/trie.hpp"
+#include "roaring.hpp"
+#include "runs.hpp"
+#include "telemetry.hpp"
 
+#include <algorithm>
 #include <filesystem>
+#include <functional>
 #include <string>
+#include <cstring>
 #include <fstream>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace fs = std::filesystem;
 
-struct DID {
-    int64_t ind;
-    int64_t name_pos;
-    int64_t dl;
-    int64_t tf;
-    int64_t pos_of_nums_lines;
-    DID() = default;
-    DID(int64_t x, int64_t p) : ind(x), name_pos(p), dl(0), tf(0) {}
-};
+// Bytes a distinct term of the run buffer adds to it, its hash in a node of the set of them.
+const int64_t bufferTermBytes = sizeof(uint64_t) + 2 * sizeof(void*);
 
 class InvertedIndex {
 public:
-    InvertedIndex() : doc_count_(0), terms_count(0), trie(new Trie()) {}
+    InvertedIndex() : doc_count_(0), terms_count(0), trie(new Trie()), memory_limit_(0), buffer_memory_(0) {}
 
     ~InvertedIndex() {
         delete trie;
@@ -45,25 +53,112 @@ public:
         trie_tree.open(trie_p, std::ios::out | std::ios::trunc);
         trie_tree.clear();
         trie_tree.close();
+
+        std::fstream line_offsets;
+        line_offsets.open(line_offsets_p, std::ios::out | std::ios::trunc);
+        line_offsets.clear();
+        line_offsets.close();
+
+        std::fstream term_hash;
+        term_hash.open(term_hash_p, std::ios::out | std::ios::trunc);
+        term_hash.close();
+
+        std::fstream analyzer;
+        analyzer.open(analyzer_p, std::ios::out | std::ios::trunc);
+        analyzer.close();
+
+        std::fstream tier;
+        tier.open(tier_p, std::ios::out | std::ios::trunc);
+        tier.close();
+
+        std::fstream duplicates;
+        duplicates.open(duplicates_p, std::ios::out | std::ios::trunc);
+        duplicates.close();
     }
 
-    void traverse(const fs::path& path) {
+    // Caps the memory of buffered postings, 0 keeps everything in memory until the final merge.
+    void setMemoryLimit(int64_t bytes) {
+        memory_limit_ = bytes;
+    }
+
+    void setAnalyzer(AnalyzerOptions options) {
+        analyzer_ = Analyzer(options);
+    }
 
-        if (fs::exists(path) && fs::is_directory(path)) {
-            for (const auto& entry : fs::recursive_directory_iterator(path)) {
-                if (fs::is_regular_file(entry.status()) && entry.path().filename().string() != ".DS_Store") {
+    // Documents with the same bytes as an indexed one, or a MinHash similarity of at least threshold to
+    // it, are left out of the index and listed with it in duplicates.txt; 0 indexes every document. A term
+    // only a left-out near copy has is not indexed, and the copy is listed whenever the indexed one matches.
+    void setDeduplication(double threshold) {
+        dedup_threshold_ = threshold;
+        detector_ = DuplicateDetector(threshold);
+    }
 
-                    addDoc(entry.path().string().c_str());
-                    ++doc_count_;
-                }
+    void setProgressInterval(double seconds) {
+        telemetry_.setInterval(seconds);
+    }
+
+    const IndexTelemetry& telemetry() const {
+        return telemetry_;
+    }
+
+    // Number of terms of all the indexed documents, the sum of their lengths.
+    int64_t termsCount() const {
+        return terms_count;
+    }
+
+    // Regular files under path in the order they are indexed, which is the order of their ids. The order of
+    // the directory iteration depends on the file system, so the paths are sorted, in descending order: the
+    // results are listed from the highest document down, that is in path order.
+    static std::vector<fs::path> listDocuments(const fs::path& path) {
+        if (!fs::exists(path) || !fs::is_directory(path)) {
+            fail("path is not a directory || does not exist.");
+        }
+        std::vector<fs::path> files;
+        for (const auto& entry : fs::recursive_directory_iterator(path)) {
+            if (fs::is_regular_file(entry.status()) && entry.path().filename().string() != ".DS_Store") {
+                files.push_back(entry.path());
             }
-        } else {
-            std::cerr << "--path is not a directory || does not exist." << '\n';
-            std::exit(EXIT_FAILURE);
+        }
+        std::sort(files.begin(), files.end(), std::greater<fs::path>());
+
+        return files;
+    }
+
+    void traverse(const fs::path& path) {
+        telemetry_.start();
+        auto walk_start = IndexTelemetry::Clock::now();
+        std::vector<fs::path> files = listDocuments(path);
+        telemetry_.add(TRAVERSE, walk_start);
+        index(files);
+    }
+
+    // Indexes the files as documents 0, 1, ... in the given order.
+    void index(const std::vector<fs::path>& files) {
+        auto walk_start = IndexTelemetry::Clock::now();
+        for (const fs::path& file : files) {
+            if (addDoc(file.string().c_str())) {
+                ++doc_count_;
+            }
+
+            telemetry_.docs = doc_count_;
+            telemetry_.tick(std::cerr);
+        }
+        telemetry_.add(TRAVERSE, walk_start);
+        for (int phase = TOKENIZE; phase < INDEX_PHASES_COUNT; ++phase) {
+            telemetry_.phases_s[TRAVERSE] -= telemetry_.phases_s[phase];
         }
     
-        int64_t dlavg = terms_count / doc_count_;
+        int64_t dlavg = doc_count_ ? terms_count / doc_count_ : 0;
 
+        auto merge_start = IndexTelemetry::Clock::now();
+        merge();
+        telemetry_.add(MERGE, merge_start);
+        telemetry_.vocabulary = trie->termsCount();
+        telemetry_.trie_nodes = trie->nodesCount();
+
+        auto dictionary_start = IndexTelemetry::Clock::now();
+        paths_.write(files_paths_p);
+        writeDuplicates();
         std::fstream trie_tree;
         trie_tree.open(trie_p, std::ios::out | std::ios::trunc);
         trie_tree.clear();
@@ -77,6 +172,9 @@ public:
         trie->saveTrieInFile(trie_tree);
 
         trie_tree.close();
+        TermHash::save(*trie);
+        analyzer_.options().save();
+        telemetry_.add(DICTIONARY_WRITE, dictionary_start);
     }
 
 private:
@@ -84,114 +182,301 @@ private:
     int64_t terms_count;
 
     Trie* trie;
+    std::vector<int64_t> line_starts;
+    PathStoreWriter paths_;
+    Analyzer analyzer_;
+    // Reused for every document: its bytes and the term being analyzed.
+    std::string content_;
+    std::string term_;
+    IndexTelemetry telemetry_;
+
+    int64_t memory_limit_;
+    int64_t buffer_memory_;
+    std::vector<RunEntry> buffer_;
+    // Hashes of the distinct terms of the buffer: the vocabulary of the progress lines is at least the
+    // largest of these counts until the merge builds the trie and counts it exactly.
+    std::unordered_set<uint64_t> buffer_terms_;
+    std::vector<std::string> runs_;
+    std::unordered_map<std::string, RunEntry> doc_terms_;
+    std::vector<int64_t> term_docs_;
+
+    double dedup_threshold_ = 0;
+    DuplicateDetector detector_;
+    DocumentSignature signature_;
+    // The indexed document and the path of its duplicate.
+    std::vector<std::pair<int64_t, std::string> > duplicates_;
+
+    // False when the document duplicates an indexed one and was left out.
+    bool addDoc(const char* p) {
+        DID dId = DID(doc_count_);
+
+        auto tokenize_start = IndexTelemetry::Clock::now();
+        double accumulated = telemetry_.phases_s[ACCUMULATE];
+        GetTerms(p, dId);
+        telemetry_.add(TOKENIZE, tokenize_start);
+        telemetry_.phases_s[TOKENIZE] -= telemetry_.phases_s[ACCUMULATE] - accumulated;
+
+        if (dedup_threshold_ > 0) {
+            int64_t original = detector_.find(content_, signature_, doc_count_);
+            signature_.reset();
+            if (original != -1) {
+                doc_terms_.clear();
+                terms_count -= dId.dl;
+                duplicates_.push_back({original, p});
+                ++telemetry_.duplicates;
+                return false;
+            }
+        }
 
-    void addDoc(const char* p) {
-        std::fstream files_paths;
-        files_paths.open(files_paths_p, std::ios::binary | std::ios::in | std::ios::out);
-        files_paths.seekg(0, std::ios::end);
-        DID dId = DID(doc_count_, files_paths.tellg());
+        auto accumulate_start = IndexTelemetry::Clock::now();
+        for (auto& [term, entry] : doc_terms_) {
+            if (buffer_terms_.insert(std::hash<std::string>()(term)).second) {
+                buffer_memory_ += bufferTermBytes;
+            }
+            buffer_memory_ += entry.memory();
+            buffer_.push_back(std::move(entry));
+        }
+        doc_terms_.clear();
+        telemetry_.vocabulary = std::max<int64_t>(telemetry_.vocabulary, buffer_terms_.size());
+        telemetry_.buffer_bytes = std::max(telemetry_.buffer_bytes, buffer_memory_);
+        telemetry_.add(ACCUMULATE, accumulate_start);
+
+        auto flush_start = IndexTelemetry::Clock::now();
+        if (memory_limit_ > 0 && buffer_memory_ >= memory_limit_) {
+            spill();
+        }
 
-        int64_t file_path_len = strlen(p);
-        files_paths.write(reinterpret_cast<char*>(&file_path_len), sizeof(int64_t));
-        files_paths.write(p, file_path_len);
+        paths_.add(p, writeLineOffsets());
+        telemetry_.add(FLUSH, flush_start);
 
-        files_paths.close();
+        return true;
+    }
 
-        GetTerms(p, dId);
-        trie->writelinesinfile(dId.ind);
+    void writeDuplicates() {
+        if (dedup_threshold_ <= 0) {
+            return;
+        }
+        DuplicateMap map;
+        PathStore paths;
+        if (!duplicates_.empty() && paths.open(files_paths_p)) {
+            for (const auto& [doc, path] : duplicates_) {
+                map.add(paths.find(doc).path, path);
+            }
+        }
+        map.write(duplicates_p);
+        duplicates_.clear();
+    }
+
+    int64_t writeLineOffsets() {
+        std::fstream line_offsets;
+        line_offsets.open(line_offsets_p, std::ios::binary | std::ios::in | std::ios::out);
+        line_offsets.seekp(0, std::ios::end);
+        int64_t line_offsets_pos = line_offsets.tellp();
+
+        int64_t lines_count = line_starts.size() - 1;
+        line_offsets.write(reinterpret_cast<char*>(&lines_count), sizeof(int64_t));
+        line_offsets.write(reinterpret_cast<char*>(line_starts.data()), line_starts.size() * sizeof(int64_t));
+
+        line_offsets.close();
+
+        return line_offsets_pos;
     }
 
     void GetTerms(const char* p, DID& dId) {
-        std::fstream file;
-        file.open(p, std::ios::binary | std::ios::in | std::ios::out);
+        std::ifstream file(p, std::ios::binary);
         if (!file.is_open()) {
-            std::cout << "--expected an input file";
-            std::exit(EXIT_FAILURE);
+            fail("expected an input file");
         }
+        file.seekg(0, std::ios::end);
+        content_.resize(std::max<int64_t>(0, file.tellg()));
+        file.seekg(0);
+        file.read(content_.data(), content_.size());
+        file.close();
+        std::string_view text = content_;
 
-        char c;
-        std::string term;
-        while (file.get(c)) {
-            if (isalpha(c)) {
-                term.push_back(std::tolower(c));
-            } else {
-                if (!term.empty()) {
-                    ++dId.dl;
+        line_starts.assign(1, 0);
+        for (size_t i = text.find('\n'); i != std::string_view::npos; i = text.find('\n', i + 1)) {
+            line_starts.push_back(i + 1);
+        }
+        line_starts.push_back(text.size());
+
+        // Line numbers start at 1, line_starts[line] is the offset of line + 1.
+        int64_t line = 0;
+        size_t pos = 0;
+        std::string_view token;
+        while (Analyzer::nextToken(text, pos, token)) {
+            int64_t begin = token.data() - text.data();
+            while (line + 1 < static_cast<int64_t>(line_starts.size()) && line_starts[line + 1] <= begin) {
+                ++line;
+            }
+            if (analyzer_.analyze(token, term_)) {
+                ++dId.dl;
+                if (dedup_threshold_ > 0) {
+                    signature_.add(term_);
                 }
-                term.clear();
+                int64_t line_num_in_file = line + 1;
+                addDocToPostingList(term_, p, dId, line_num_in_file);
             }
         }
-        if (!term.empty()) {
-            ++dId.dl;
+        for (auto& [term, entry] : doc_terms_) {
+            entry.dId.dl = dId.dl;
         }
         terms_count += dId.dl;
-        term.clear();
-
-        file.close();
-        file.open(p, std::ios::binary | std::ios::in | std::ios::out);
+        telemetry_.input_bytes += text.size();
+    }
 
-        int64_t line_num_in_file = 1;
-        while (file.get(c)) {
-            if (c != ' ' && c != '\n') {
-                term.push_back(std::tolower(c));
-            } else {
+    void addDocToPostingList(const std::string& term, const char* p, DID& dId, int64_t& num_of_line) {
+        auto accumulate_start = IndexTelemetry::Clock::now();
 
-                if (!term.empty()) {
-                    addDocToPostingList(term, p, dId, line_num_in_file);
-                }
-                if (c == '\n') {
-                    ++line_num_in_file;
-                }
-                term.clear();
-            }
+        auto it = doc_terms_.find(term);
+        if (it == doc_terms_.end()) {
+            it = doc_terms_.emplace(term, RunEntry()).first;
+        }
+        RunEntry& entry = it->second;
+        if (entry.lines.empty()) {
+            entry.term = term;
+            entry.dId = dId;
         }
-        if (!term.empty()) {
-            addDocToPostingList(term, p, dId, line_num_in_file);
+        ++entry.dId.tf;
+        if (entry.lines.empty() || entry.lines.back() != num_of_line) {
+            entry.lines.push_back(num_of_line);
         }
 
-        file.close();
+        telemetry_.add(ACCUMULATE, accumulate_start);
+    }
+
+    void sortBuffer() {
+        std::sort(buffer_.begin(), buffer_.end());
+    }
+
+    // Writes the buffered postings sorted by (term, document) as the next run.
+    void spill() {
+        if (buffer_.empty()) {
+            return;
+        }
+        sortBuffer();
+
+        fs::create_directories(runsDir());
+        std::string path = (runsDir() / ("run" + std::to_string(runs_.size()))).string();
+        FileRun::write(path, buffer_);
+        runs_.push_back(path);
+        ++telemetry_.runs;
+        telemetry_.run_bytes += IndexTelemetry::fileSize(path.c_str());
+
+        buffer_.clear();
+        buffer_.shrink_to_fit();
+        buffer_terms_.clear();
+        buffer_memory_ = 0;
     }
 
-    void addDocToPostingList(std::string& term, const char* p, DID& dId, int64_t& num_of_line) {
+    static fs::path runsDir() {
+        return fs::path(posting_lists_p).parent_path() / "runs";
+    }
+
+    // K-way merge of the runs: every term gets its posting list and line numbers written sequentially
+    // and its position inserted into the trie.
+    void merge() {
+        std::vector<std::unique_ptr<RunSource> > sources;
+        if (runs_.empty()) {
+            sortBuffer();
+            sources.emplace_back(new MemoryRun(buffer_));
+        } else {
+            spill();
+            for (const std::string& run : runs_) {
+                sources.emplace_back(new FileRun(run));
+            }
+        }
+
+        std::vector<RunEntry> heads(sources.size());
+        auto greater = [&heads](size_t a, size_t b) {
+            return heads[b] < heads[a];
+        };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(greater)> queue(greater);
+        for (size_t i = 0; i < sources.size(); ++i) {
+            if (sources[i]->next(heads[i])) {
+                queue.push(i);
+            }
+        }
+
+        std::unique_ptr<char[]> postings_buffer(new char[runBufferSizeof]);
         std::fstream posting_lists;
+        posting_lists.rdbuf()->pubsetbuf(postings_buffer.get(), runBufferSizeof);
         posting_lists.open(posting_lists_p, std::ios::binary | std::ios::in | std::ios::out);
+        posting_lists.seekp(0, std::ios::end);
 
-        int64_t posting_list_pos = trie->insert(term, posting_lists, num_of_line);
-        posting_lists.seekg(posting_list_pos);
-        int64_t df;
-        posting_lists.read(reinterpret_cast<char*>(&df), sizeof(int64_t));
-
-        DID temp;
-        bool is_here = false;
-
-        for (int64_t i = 0; i < df; ++i) {
-            posting_lists.seekp(posting_list_pos + sizeof(int64_t) + i * (sizeof(DID)));
-            posting_lists.read(reinterpret_cast<char*>(&temp), sizeof(DID));
-
-            if (temp.ind == dId.ind) {
-                ++temp.tf;
-                int64_t pt = posting_lists.tellg();
-                posting_lists.seekp(pt - 2 * sizeof(int64_t));
-                posting_lists.write(reinterpret_cast<char*>(&temp.tf), sizeof(int64_t));
-                is_here = true;
-                break;
+        std::unique_ptr<char[]> lines_buffer(new char[runBufferSizeof]);
+        std::fstream line_nums;
+        line_nums.rdbuf()->pubsetbuf(lines_buffer.get(), runBufferSizeof);
+        line_nums.open(line_nums_p, std::ios::binary | std::ios::in | std::ios::out);
+        line_nums.seekp(0, std::ios::end);
+
+        int64_t posting_list_pos = posting_lists.tellp();
+        int64_t line_nums_pos = line_nums.tellp();
+        std::string term;
+        int64_t df = 0;
+
+        while (!queue.empty()) {
+            size_t i = queue.top();
+            queue.pop();
+            RunEntry& entry = heads[i];
+
+            if (df == 0 || entry.term != term) {
+                finishPostingList(posting_lists, posting_list_pos, term, df);
+                term = entry.term;
+                posting_list_pos = posting_lists.tellp();
+                df = 0;
+                term_docs_.clear();
+                posting_lists.write(reinterpret_cast<char*>(&df), sizeof(int64_t));
+            }
+
+            entry.dId.pos_of_nums_lines = line_nums_pos;
+            int64_t lines_count = entry.lines.size();
+            line_nums.write(reinterpret_cast<char*>(&lines_count), sizeof(int64_t));
+            line_nums.write(reinterpret_cast<char*>(entry.lines.data()), lines_count * sizeof(int64_t));
+            line_nums_pos += (lines_count + 1) * sizeof(int64_t);
+
+            posting_lists.write(reinterpret_cast<char*>(&entry.dId), sizeof(DID));
+            term_docs_.push_back(entry.dId.ind);
+            ++df;
+
+            if (sources[i]->next(heads[i])) {
+                queue.push(i);
             }
         }
+        finishPostingList(posting_lists, posting_list_pos, term, df);
 
-        if (is_here) {
-            posting_lists.seekg(0, std::ios::end);
+        posting_lists.close();
+        line_nums.close();
 
-            return;
+        buffer_.clear();
+        buffer_terms_.clear();
+        for (const std::string& run : runs_) {
+            fs::remove(run);
+        }
+        if (!runs_.empty()) {
+            fs::remove(runsDir());
         }
+        runs_.clear();
+    }
 
-        ++df;
-        temp.tf = 1;
+    // Writes the df of the list and, for a dense term, the bitmap of its documents right after the DIDs.
+    void finishPostingList(std::fstream& posting_lists, int64_t posting_list_pos, const std::string& term, int64_t df) {
+        if (df == 0) {
+            return;
+        }
+        if (denseTerm(df, doc_count_)) {
+            Roaring bitmap;
+            for (int64_t doc : term_docs_) {
+                bitmap.add(doc);
+            }
+            bitmap.write(posting_lists);
+            ++telemetry_.bitmaps;
+        }
+        int64_t end = posting_lists.tellp();
         posting_lists.seekp(posting_list_pos);
         posting_lists.write(reinterpret_cast<char*>(&df), sizeof(int64_t));
-        posting_lists.seekp(posting_list_pos + sizeof(int64_t) + df * sizeof(DID) -  sizeof(DID));
-        posting_lists.write(reinterpret_cast<char*>(&dId), sizeof(DID));
-        posting_lists.seekg(0, std::ios::end);
+        posting_lists.seekp(end);
 
-        posting_lists.close();
+        trie->insert(term, posting_list_pos);
     }
 };
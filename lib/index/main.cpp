@@ -1,8 +1,126 @@
+#include "generations.hpp"
 #include "index.hpp"
+#include "shards.hpp"
+#include "tiers.hpp"
+
+#include <algorithm>
 
 int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        std::cerr << "--expected a directory to index" << '\n';
+        std::exit(EXIT_FAILURE);
+    }
+
+    double progress = 0;
+    int64_t memory_limit = 0;
+    int64_t shards = 0;
+    AnalyzerOptions analyzer;
+    bool summary = false;
+    bool json = false;
+    int64_t tier = 0;
+    double dedup = 0;
+
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--progress" && i + 1 < argc) {
+            progress = std::stod(argv[++i]);
+            summary = true;
+        } else if (arg == "--memory-limit" && i + 1 < argc) {
+            memory_limit = parseSize(argv[++i]);
+        } else if (arg == "--shards" && i + 1 < argc) {
+            shards = std::stoll(argv[++i]);
+            if (shards < 1) {
+                std::cerr << "--shards expects a positive number" << '\n';
+                std::exit(EXIT_FAILURE);
+            }
+        } else if (arg == "--stopwords") {
+            analyzer.flags |= AnalyzerOptions::STOPWORDS;
+        } else if (arg == "--stem") {
+            analyzer.flags |= AnalyzerOptions::STEMMING;
+        } else if (arg == "--tier" && i + 1 < argc) {
+            tier = std::stoll(argv[++i]);
+            if (tier < 1) {
+                std::cerr << "--tier expects a positive number" << '\n';
+                std::exit(EXIT_FAILURE);
+            }
+        } else if (arg == "--dedup" && i + 1 < argc) {
+            dedup = std::stod(argv[++i]);
+            if (dedup <= 0 || dedup > 1) {
+                std::cerr << "--dedup expects a similarity in (0, 1]" << '\n';
+                std::exit(EXIT_FAILURE);
+            }
+        } else if (arg == "--stats-json") {
+            json = true;
+        } else {
+            std::cerr << "--unknown option: " << arg << '\n';
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    auto build = [&](const std::vector<fs::path>* files) {
+        InvertedIndex ii;
+        ii.setProgressInterval(progress);
+        ii.setMemoryLimit(memory_limit);
+        ii.setAnalyzer(analyzer);
+        ii.setDeduplication(dedup);
+        ii.erase();
+        if (files == nullptr) {
+            ii.traverse(argv[1]);
+        } else {
+            ii.index(*files);
+        }
+        if (tier > 0) {
+            TierWriter(tier).run();
+        }
+
+        if (summary) {
+            std::cerr << ii.telemetry().summary();
+        }
+        if (json) {
+            std::cerr << ii.telemetry().toJson() << '\n';
+        }
+
+        return ShardInfo{0, ii.telemetry().docs, ii.termsCount()};
+    };
+
+    if (shards > 0 && dedup > 0) {
+        std::cerr << "--dedup does not apply to shards, their document ids follow the traversal order" << '\n';
+        std::exit(EXIT_FAILURE);
+    }
+
+    // The running searchers keep reading the published generation while this one is built.
+    IndexGenerations generations = IndexGenerations::fromIndexDir();
+    int64_t generation = generations.next();
+    fs::create_directories(generations.dir(generation));
+    setIndexDir(generations.dir(generation));
+
+    if (shards == 0) {
+        build(nullptr);
+        generations.publish(generation);
+        generations.prune();
+        return 0;
+    }
+
+    // Contiguous ranges of the traversal order, so a document keeps the id it has in a single index.
+    std::vector<fs::path> files = InvertedIndex::listDocuments(argv[1]);
+    std::string index_dir = fs::path(trie_p).parent_path().string();
+    ShardManifest manifest;
+    int64_t count = std::max<int64_t>(1, std::min<int64_t>(shards, files.size()));
+    int64_t first = 0;
+    for (int64_t shard = 0; shard < count; ++shard) {
+        int64_t last = files.size() * (shard + 1) / count;
+        std::vector<fs::path> slice(files.begin() + first, files.begin() + last);
+
+        fs::create_directories(ShardManifest::shardDir(shard));
+        setIndexDir(ShardManifest::shardDir(shard));
+        ShardInfo info = build(&slice);
+        info.first_doc = first;
+        manifest.shards.push_back(info);
+        setIndexDir(index_dir);
 
-    InvertedIndex ii;
-    ii.erase();
-    ii.traverse(argv[1]);
+        first = last;
+    }
+    manifest.write();
+    generations.publish(generation);
+    generations.prune();
 }
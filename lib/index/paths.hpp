@@ -0,0 +1,171 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// files.txt maps a document id to its path and to the position of its line offsets. Paths are front
+// coded in buckets of pathBucketSize documents: the first path of a bucket is stored whole, every next
+// one as the length of the prefix it shares with the path before it, the length of the rest and the
+// rest, followed by the position of the line offsets of the document, all numbers as varints. A lookup
+// goes straight to its bucket and decodes at most the pathBucketSize - 1 entries before its own, so
+// the postings need no position of the path.
+//
+// File format: int64 documents count, int64 bucket size, int64 offset of every bucket from the start
+// of the entries, then the entries.
+const int64_t pathBucketSize = 16;
+
+struct DocumentPath {
+    std::string path;
+    int64_t line_offsets_pos;
+};
+
+class PathStoreWriter {
+public:
+    void add(std::string_view path, int64_t line_offsets_pos) {
+        if (size_ % pathBucketSize == 0) {
+            buckets_.push_back(data_.size());
+            previous_.clear();
+        }
+        size_t shared = 0;
+        while (shared < previous_.size() && shared < path.size() && previous_[shared] == path[shared]) {
+            ++shared;
+        }
+        writeVarint(shared);
+        writeVarint(path.size() - shared);
+        data_.append(path.substr(shared));
+        writeVarint(line_offsets_pos);
+        previous_.assign(path);
+        ++size_;
+    }
+
+    int64_t size() const {
+        return size_;
+    }
+
+    void write(const char* path) const {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        int64_t header[2] = {size(), pathBucketSize};
+        out.write(reinterpret_cast<const char*>(header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(buckets_.data()), buckets_.size() * sizeof(int64_t));
+        out.write(data_.data(), data_.size());
+    }
+
+private:
+    int64_t size_ = 0;
+    std::string data_;
+    std::string previous_;
+    std::vector<int64_t> buckets_;
+
+    void writeVarint(uint64_t value) {
+        while (value >= 0x80) {
+            data_.push_back(static_cast<char>(value | 0x80));
+            value >>= 7;
+        }
+        data_.push_back(static_cast<char>(value));
+    }
+};
+
+// Read side of files.txt, mapped into memory.
+class PathStore {
+public:
+    PathStore() : map_(MAP_FAILED), map_size_(0), docs_(0), bucket_size_(pathBucketSize), buckets_(nullptr), data_(nullptr) {}
+
+    ~PathStore() {
+        close();
+    }
+
+    PathStore(const PathStore&) = delete;
+    PathStore& operator=(const PathStore&) = delete;
+
+    // False when the file is missing or is not a path store.
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st{};
+        fstat(fd, &st);
+        map_size_ = st.st_size;
+        if (map_size_ >= static_cast<int64_t>(2 * sizeof(int64_t))) {
+            map_ = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (map_ == MAP_FAILED) {
+            return false;
+        }
+        madvise(map_, map_size_, MADV_RANDOM);
+
+        const int64_t* header = static_cast<const int64_t*>(map_);
+        docs_ = header[0];
+        bucket_size_ = header[1];
+        int64_t buckets = bucket_size_ > 0 ? (docs_ + bucket_size_ - 1) / bucket_size_ : -1;
+        if (docs_ < 0 || buckets < 0 || (2 + buckets) * static_cast<int64_t>(sizeof(int64_t)) > map_size_) {
+            close();
+            return false;
+        }
+        buckets_ = header + 2;
+        data_ = reinterpret_cast<const char*>(buckets_ + buckets);
+
+        return true;
+    }
+
+    int64_t size() const {
+        return docs_;
+    }
+
+    // The bytes decoded to find the document are added to decoded.
+    DocumentPath find(int64_t doc, int64_t* decoded = nullptr) const {
+        const char* begin = data_ + buckets_[doc / bucket_size_];
+        const char* p = begin;
+        DocumentPath rez;
+        for (int64_t i = doc - doc % bucket_size_; i <= doc; ++i) {
+            uint64_t shared = readVarint(p);
+            uint64_t rest = readVarint(p);
+            rez.path.resize(shared);
+            rez.path.append(p, rest);
+            p += rest;
+            rez.line_offsets_pos = readVarint(p);
+        }
+        if (decoded != nullptr) {
+            *decoded += p - begin;
+        }
+
+        return rez;
+    }
+
+private:
+    void* map_;
+    int64_t map_size_;
+    int64_t docs_;
+    int64_t bucket_size_;
+    const int64_t* buckets_;
+    const char* data_;
+
+    static uint64_t readVarint(const char*& p) {
+        uint64_t value = 0;
+        for (int shift = 0;; shift += 7) {
+            unsigned char b = *p++;
+            value |= static_cast<uint64_t>(b & 0x7F) << shift;
+            if (b < 0x80) {
+                return value;
+            }
+        }
+    }
+
+    void close() {
+        if (map_ != MAP_FAILED) {
+            munmap(map_, map_size_);
+            map_ = MAP_FAILED;
+        }
+        docs_ = 0;
+    }
+};
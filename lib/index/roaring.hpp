@@ -0,0 +1,294 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <istream>
+#include <iterator>
+#include <ostream>
+#include <vector>
+
+// A posting list gets a bitmap of its documents written after its DIDs when the term is in
+// at least 1 / bitmapDensity of the documents. Reader and writer decide with the same rule.
+const int64_t bitmapDensity = 16;
+
+inline bool denseTerm(int64_t df, int64_t doc_count) {
+    return df * bitmapDensity >= doc_count;
+}
+
+// Roaring bitmap of document ids: the ids are split by their high bits into chunks of 65536, a chunk
+// with few documents keeps a sorted array of the low 16 bits, a fuller one a bitset of 1024 words.
+//
+// File format: int64 containers count, then per container int64 key, int64 cardinality and either
+// cardinality uint16 values or bitsetWords uint64 words when cardinality > arrayContainerLimit.
+class Roaring {
+public:
+    static const int64_t arrayContainerLimit = 4096;
+    static const int64_t bitsetWords = 1024;
+
+    // Ids must be added in increasing order.
+    void add(int64_t doc) {
+        int64_t key = doc >> 16;
+        if (containers_.empty() || containers_.back().key != key) {
+            containers_.push_back({key, 0, {}, {}});
+        }
+        Container& c = containers_.back();
+        uint16_t low = static_cast<uint16_t>(doc & 0xFFFF);
+        if (c.bits.empty()) {
+            c.array.push_back(low);
+        } else {
+            c.bits[low >> 6] |= uint64_t(1) << (low & 63);
+        }
+        ++c.cardinality;
+        normalize(c);
+        ranks_.clear();
+    }
+
+    int64_t cardinality() const {
+        int64_t rez = 0;
+        for (const Container& c : containers_) {
+            rez += c.cardinality;
+        }
+
+        return rez;
+    }
+
+    bool empty() const {
+        return containers_.empty();
+    }
+
+    // Number of ids < doc, the position of doc in the posting list when it is there.
+    int64_t rank(int64_t doc) const {
+        if (ranks_.size() != containers_.size()) {
+            ranks_.resize(containers_.size());
+            int64_t total = 0;
+            for (size_t i = 0; i < containers_.size(); ++i) {
+                ranks_[i] = total;
+                total += containers_[i].cardinality;
+            }
+        }
+
+        int64_t key = doc >> 16;
+        auto it = std::lower_bound(containers_.begin(), containers_.end(), key, [](const Container& c, int64_t k) {
+            return c.key < k;
+        });
+        if (it == containers_.end()) {
+            return cardinality();
+        }
+        int64_t rez = ranks_[it - containers_.begin()];
+        if (it->key != key) {
+            return rez;
+        }
+
+        uint16_t low = static_cast<uint16_t>(doc & 0xFFFF);
+        if (it->bits.empty()) {
+            return rez + (std::lower_bound(it->array.begin(), it->array.end(), low) - it->array.begin());
+        }
+        for (int64_t w = 0; w < (low >> 6); ++w) {
+            rez += std::popcount(it->bits[w]);
+        }
+
+        return rez + std::popcount(it->bits[low >> 6] & ((uint64_t(1) << (low & 63)) - 1));
+    }
+
+    std::vector<int64_t> toVector() const {
+        std::vector<int64_t> rez;
+        rez.reserve(cardinality());
+        for (const Container& c : containers_) {
+            int64_t base = c.key << 16;
+            if (c.bits.empty()) {
+                for (uint16_t low : c.array) {
+                    rez.push_back(base + low);
+                }
+                continue;
+            }
+            for (int64_t w = 0; w < bitsetWords; ++w) {
+                for (uint64_t word = c.bits[w]; word; word &= word - 1) {
+                    rez.push_back(base + w * 64 + std::countr_zero(word));
+                }
+            }
+        }
+
+        return rez;
+    }
+
+    static Roaring And(const Roaring& a, const Roaring& b) {
+        return combine(a, b, AND_OP);
+    }
+
+    static Roaring Or(const Roaring& a, const Roaring& b) {
+        return combine(a, b, OR_OP);
+    }
+
+    static Roaring AndNot(const Roaring& a, const Roaring& b) {
+        return combine(a, b, AND_NOT_OP);
+    }
+
+    void write(std::ostream& out) const {
+        int64_t count = containers_.size();
+        out.write(reinterpret_cast<const char*>(&count), sizeof(int64_t));
+        for (const Container& c : containers_) {
+            out.write(reinterpret_cast<const char*>(&c.key), sizeof(int64_t));
+            out.write(reinterpret_cast<const char*>(&c.cardinality), sizeof(int64_t));
+            if (c.bits.empty()) {
+                out.write(reinterpret_cast<const char*>(c.array.data()), c.array.size() * sizeof(uint16_t));
+            } else {
+                out.write(reinterpret_cast<const char*>(c.bits.data()), bitsetWords * sizeof(uint64_t));
+            }
+        }
+    }
+
+    // Returns the number of bytes read.
+    int64_t read(std::istream& in) {
+        containers_.clear();
+        ranks_.clear();
+        int64_t count = 0;
+        in.read(reinterpret_cast<char*>(&count), sizeof(int64_t));
+        int64_t bytes = sizeof(int64_t);
+        containers_.resize(count);
+        for (Container& c : containers_) {
+            in.read(reinterpret_cast<char*>(&c.key), sizeof(int64_t));
+            in.read(reinterpret_cast<char*>(&c.cardinality), sizeof(int64_t));
+            bytes += 2 * sizeof(int64_t);
+            if (c.cardinality <= arrayContainerLimit) {
+                c.array.resize(c.cardinality);
+                in.read(reinterpret_cast<char*>(c.array.data()), c.cardinality * sizeof(uint16_t));
+                bytes += c.cardinality * sizeof(uint16_t);
+            } else {
+                c.bits.resize(bitsetWords);
+                in.read(reinterpret_cast<char*>(c.bits.data()), bitsetWords * sizeof(uint64_t));
+                bytes += bitsetWords * sizeof(uint64_t);
+            }
+        }
+
+        return bytes;
+    }
+
+private:
+    struct Container {
+        int64_t key;
+        int64_t cardinality;
+        std::vector<uint16_t> array;
+        std::vector<uint64_t> bits;
+    };
+
+    enum Operation {
+        AND_OP,
+        OR_OP,
+        AND_NOT_OP,
+    };
+
+    std::vector<Container> containers_;
+    mutable std::vector<int64_t> ranks_;
+
+    static void toBitset(Container& c) {
+        if (!c.bits.empty()) {
+            return;
+        }
+        c.bits.assign(bitsetWords, 0);
+        for (uint16_t low : c.array) {
+            c.bits[low >> 6] |= uint64_t(1) << (low & 63);
+        }
+        c.array.clear();
+        c.array.shrink_to_fit();
+    }
+
+    // Keeps the representation Roaring expects: arrays up to arrayContainerLimit ids, bitsets above.
+    static void normalize(Container& c) {
+        if (c.bits.empty()) {
+            if (c.cardinality > arrayContainerLimit) {
+                toBitset(c);
+            }
+            return;
+        }
+        if (c.cardinality <= arrayContainerLimit) {
+            c.array.clear();
+            for (int64_t w = 0; w < bitsetWords; ++w) {
+                for (uint64_t word = c.bits[w]; word; word &= word - 1) {
+                    c.array.push_back(static_cast<uint16_t>(w * 64 + std::countr_zero(word)));
+                }
+            }
+            c.bits.clear();
+            c.bits.shrink_to_fit();
+        }
+    }
+
+    static Container apply(const Container& a, const Container& b, Operation op) {
+        Container rez{a.key, 0, {}, {}};
+        if (a.bits.empty() && b.bits.empty()) {
+            switch (op) {
+                case AND_OP:
+                    std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(rez.array));
+                    break;
+                case OR_OP:
+                    std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(rez.array));
+                    break;
+                case AND_NOT_OP:
+                    std::set_difference(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(), std::back_inserter(rez.array));
+                    break;
+            }
+            rez.cardinality = rez.array.size();
+            normalize(rez);
+
+            return rez;
+        }
+
+        // Word at a time over 1024 words, the loops are simple enough for the compiler to vectorize.
+        Container x = a;
+        Container y = b;
+        toBitset(x);
+        toBitset(y);
+        rez.bits.resize(bitsetWords);
+        switch (op) {
+            case AND_OP:
+                for (int64_t w = 0; w < bitsetWords; ++w) {
+                    rez.bits[w] = x.bits[w] & y.bits[w];
+                }
+                break;
+            case OR_OP:
+                for (int64_t w = 0; w < bitsetWords; ++w) {
+                    rez.bits[w] = x.bits[w] | y.bits[w];
+                }
+                break;
+            case AND_NOT_OP:
+                for (int64_t w = 0; w < bitsetWords; ++w) {
+                    rez.bits[w] = x.bits[w] & ~y.bits[w];
+                }
+                break;
+        }
+        for (int64_t w = 0; w < bitsetWords; ++w) {
+            rez.cardinality += std::popcount(rez.bits[w]);
+        }
+        normalize(rez);
+
+        return rez;
+    }
+
+    static Roaring combine(const Roaring& a, const Roaring& b, Operation op) {
+        Roaring rez;
+        size_t i = 0;
+        size_t j = 0;
+        while (i < a.containers_.size() || j < b.containers_.size()) {
+            bool has_a = i < a.containers_.size();
+            bool has_b = j < b.containers_.size();
+            if (has_a && (!has_b || a.containers_[i].key < b.containers_[j].key)) {
+                if (op != AND_OP) {
+                    rez.containers_.push_back(a.containers_[i]);
+                }
+                ++i;
+            } else if (has_b && (!has_a || b.containers_[j].key < a.containers_[i].key)) {
+                if (op == OR_OP) {
+                    rez.containers_.push_back(b.containers_[j]);
+                }
+                ++j;
+            } else {
+                Container c = apply(a.containers_[i++], b.containers_[j++], op);
+                if (c.cardinality > 0) {
+                    rez.containers_.push_back(std::move(c));
+                }
+            }
+        }
+
+        return rez;
+    }
+};
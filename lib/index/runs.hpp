@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+struct DID {
+    int64_t ind;
+    int64_t dl;
+    int64_t tf;
+    int64_t pos_of_nums_lines;
+    DID() = default;
+    explicit DID(int64_t x) : ind(x), dl(0), tf(0) {}
+};
+
+// One (term, document) pair of a run: the posting and the lines of the document the term is on.
+struct RunEntry {
+    std::string term;
+    DID dId;
+    std::vector<int64_t> lines;
+
+    int64_t memory() const {
+        return sizeof(RunEntry) + term.capacity() + lines.capacity() * sizeof(int64_t);
+    }
+
+    bool operator<(const RunEntry& other) const {
+        return term != other.term ? term < other.term : dId.ind < other.dId.ind;
+    }
+};
+
+const int64_t runBufferSizeof = 1 << 20;
+
+// Entries sorted by (term, document) coming either from memory or from a spilled run file.
+class RunSource {
+public:
+    virtual ~RunSource() = default;
+
+    virtual bool next(RunEntry& entry) = 0;
+};
+
+class MemoryRun : public RunSource {
+public:
+    explicit MemoryRun(std::vector<RunEntry>& entries) : entries_(entries), pos_(0) {}
+
+    bool next(RunEntry& entry) override {
+        if (pos_ == entries_.size()) {
+            return false;
+        }
+        entry = std::move(entries_[pos_++]);
+
+        return true;
+    }
+
+private:
+    std::vector<RunEntry>& entries_;
+    size_t pos_;
+};
+
+// Runs are read once from start to end: the kernel is told so to read ahead aggressively, and the
+// pages already merged are dropped so that a merge does not push the index out of the page cache.
+class FileRun : public RunSource {
+public:
+    explicit FileRun(const std::string& path) : buffer_(new char[runBufferSizeof]), begin_(0), end_(0), offset_(0), dropped_(0) {
+        fd_ = open(path.c_str(), O_RDONLY);
+        posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    ~FileRun() override {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    static void write(const std::string& path, const std::vector<RunEntry>& entries) {
+        std::unique_ptr<char[]> buffer(new char[runBufferSizeof]);
+        std::ofstream run;
+        run.rdbuf()->pubsetbuf(buffer.get(), runBufferSizeof);
+        run.open(path, std::ios::binary | std::ios::out | std::ios::trunc);
+
+        for (const RunEntry& entry : entries) {
+            int64_t term_len = entry.term.size();
+            run.write(reinterpret_cast<const char*>(&term_len), sizeof(int64_t));
+            run.write(entry.term.data(), term_len);
+            run.write(reinterpret_cast<const char*>(&entry.dId), sizeof(DID));
+
+            int64_t lines_count = entry.lines.size();
+            run.write(reinterpret_cast<const char*>(&lines_count), sizeof(int64_t));
+            run.write(reinterpret_cast<const char*>(entry.lines.data()), lines_count * sizeof(int64_t));
+        }
+    }
+
+    bool next(RunEntry& entry) override {
+        int64_t term_len;
+        if (!read(&term_len, sizeof(int64_t))) {
+            return false;
+        }
+        entry.term.resize(term_len);
+        read(entry.term.data(), term_len);
+        read(&entry.dId, sizeof(DID));
+
+        int64_t lines_count;
+        read(&lines_count, sizeof(int64_t));
+        entry.lines.resize(lines_count);
+
+        return read(entry.lines.data(), lines_count * sizeof(int64_t));
+    }
+
+private:
+    std::unique_ptr<char[]> buffer_;
+    int fd_;
+    int64_t begin_;
+    int64_t end_;
+    int64_t offset_;
+    int64_t dropped_;
+
+    bool read(void* dest, int64_t size) {
+        char* out = static_cast<char*>(dest);
+        while (size > 0) {
+            if (begin_ == end_) {
+                ssize_t n = ::read(fd_, buffer_.get(), runBufferSizeof);
+                if (n <= 0) {
+                    return false;
+                }
+                begin_ = 0;
+                end_ = n;
+                offset_ += n;
+                if (offset_ - dropped_ >= 16 * runBufferSizeof) {
+                    posix_fadvise(fd_, dropped_, offset_ - n - dropped_, POSIX_FADV_DONTNEED);
+                    dropped_ = offset_ - n;
+                }
+            }
+            int64_t n = std::min(size, end_ - begin_);
+            std::memcpy(out, buffer_.get() + begin_, n);
+            begin_ += n;
+            out += n;
+            size -= n;
+        }
+
+        return true;
+    }
+};
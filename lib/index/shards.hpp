@@ -0,0 +1,72 @@
+#pragma once
+#include "../trie/trie.hpp"
+#include "../trie/errors.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// A shard is a complete index of a contiguous range of the documents, so the id of a document in
+// the collection is the first_doc of its shard plus its id in the shard.
+struct ShardInfo {
+    int64_t first_doc;
+    int64_t doc_count;
+    int64_t terms_count;
+};
+
+// Shards live in <index dir>/shards/<i>, next to a manifest listing them. The manifest holds
+// int64 shards count, then first_doc, doc_count and terms_count of every shard.
+class ShardManifest {
+public:
+    std::vector<ShardInfo> shards;
+
+    static std::filesystem::path root() {
+        return std::filesystem::path(trie_p).parent_path() / "shards";
+    }
+
+    static std::string shardDir(size_t shard) {
+        return (root() / std::to_string(shard)).string();
+    }
+
+    static bool exists() {
+        return std::filesystem::exists(root() / "manifest.txt");
+    }
+
+    void write() const {
+        std::fstream manifest;
+        manifest.open(root() / "manifest.txt", std::ios::binary | std::ios::out | std::ios::trunc);
+        int64_t count = shards.size();
+        manifest.write(reinterpret_cast<const char*>(&count), sizeof(int64_t));
+        manifest.write(reinterpret_cast<const char*>(shards.data()), count * sizeof(ShardInfo));
+        manifest.close();
+    }
+
+    void read() {
+        std::fstream manifest;
+        manifest.open(root() / "manifest.txt", std::ios::binary | std::ios::in);
+        int64_t count = 0;
+        manifest.read(reinterpret_cast<char*>(&count), sizeof(int64_t));
+        shards.resize(count);
+        manifest.read(reinterpret_cast<char*>(shards.data()), count * sizeof(ShardInfo));
+        if (!manifest || count == 0) {
+            fail("no shards found, run ./index with --shards first");
+        }
+        manifest.close();
+    }
+
+    // Average document length of the whole collection, computed the way a single index computes it.
+    int64_t dlavg() const {
+        int64_t docs = 0;
+        int64_t terms = 0;
+        for (const ShardInfo& shard : shards) {
+            docs += shard.doc_count;
+            terms += shard.terms_count;
+        }
+
+        return docs ? terms / docs : 0;
+    }
+};
@@ -0,0 +1,206 @@
+#pragma once
+#include "../trie/trie.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <sys/resource.h>
+
+enum IndexPhase {
+    TRAVERSE,
+    TOKENIZE,
+    ACCUMULATE,
+    FLUSH,
+    MERGE,
+    DICTIONARY_WRITE,
+    INDEX_PHASES_COUNT,
+};
+
+const char* const index_phase_names[INDEX_PHASES_COUNT] = {
+    "traverse", "tokenize", "accumulate", "flush", "merge", "dictionary_write",
+};
+
+struct IndexFileSize {
+    const char* name;
+    const char* const* path;
+};
+
+const IndexFileSize index_files[] = {
+    {"postinglists", &posting_lists_p},
+    {"files", &files_paths_p},
+    {"numbersOfLines", &line_nums_p},
+    {"lineOffsets", &line_offsets_p},
+    {"trie", &trie_p},
+    {"termHash", &term_hash_p},
+    {"duplicates", &duplicates_p},
+};
+
+// "512M" -> bytes, K, M and G suffixes are accepted.
+inline int64_t parseSize(const std::string& value) {
+    size_t end;
+    int64_t size = std::stoll(value, &end);
+    switch (end < value.size() ? std::toupper(value[end]) : 'B') {
+        case 'G':
+            size *= 1024;
+            [[fallthrough]];
+        case 'M':
+            size *= 1024;
+            [[fallthrough]];
+        case 'K':
+            size *= 1024;
+    }
+
+    return size;
+}
+
+// Progress and phase timings of one InvertedIndex::traverse. With a zero interval nothing is
+// printed while indexing, the phases are still timed for the final summary.
+class IndexTelemetry {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    int64_t docs = 0;
+    int64_t input_bytes = 0;
+    int64_t vocabulary = 0;
+    int64_t trie_nodes = 0;
+    int64_t buffer_bytes = 0;
+    int64_t runs = 0;
+    int64_t run_bytes = 0;
+    int64_t bitmaps = 0;
+    int64_t duplicates = 0;
+    double phases_s[INDEX_PHASES_COUNT] = {};
+
+    IndexTelemetry() : interval_s_(0), start_(Clock::now()), last_report_(start_) {}
+
+    void setInterval(double seconds) {
+        interval_s_ = seconds;
+    }
+
+    void start() {
+        *this = IndexTelemetry(interval_s_);
+    }
+
+    void add(IndexPhase phase, Clock::time_point since) {
+        phases_s[phase] += std::chrono::duration<double>(Clock::now() - since).count();
+    }
+
+    void tick(std::ostream& out) {
+        if (interval_s_ <= 0) {
+            return;
+        }
+        Clock::time_point now = Clock::now();
+        if (std::chrono::duration<double>(now - last_report_).count() >= interval_s_) {
+            last_report_ = now;
+            out << "--progress " << line() << '\n';
+        }
+    }
+
+    double elapsed() const {
+        return std::chrono::duration<double>(Clock::now() - start_).count();
+    }
+
+    static int64_t peakRssBytes() {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+
+        return static_cast<int64_t>(usage.ru_maxrss) * 1024;
+    }
+
+    int64_t trieBytes() const {
+        return trie_nodes * static_cast<int64_t>(sizeof(TrieNode) + sizeof(TrieNode*));
+    }
+
+    static int64_t fileSize(const char* path) {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+
+        return ec ? 0 : static_cast<int64_t>(size);
+    }
+
+    std::string line() const {
+        double seconds = std::max(elapsed(), 1e-9);
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(1)
+            << "docs " << docs << " (" << docs / seconds << " docs/s)"
+            << ", input " << human(input_bytes) << " (" << input_bytes / 1048576.0 / seconds << " MB/s)"
+            << ", vocabulary " << vocabulary
+            << ", trie nodes " << trie_nodes << " (~" << human(trieBytes()) << ")"
+            << ", peak buffer " << human(buffer_bytes) << ", runs " << runs << " (" << human(run_bytes) << ")"
+            << ", bitmaps " << bitmaps
+            << ", duplicates " << duplicates;
+        for (const IndexFileSize& file : index_files) {
+            out << ", " << file.name << ' ' << human(fileSize(*file.path));
+        }
+        out << ", peak RSS " << human(peakRssBytes());
+
+        return out.str();
+    }
+
+    static std::string human(int64_t bytes) {
+        const char* units[] = {"B", "KB", "MB", "GB", "TB"};
+        double value = bytes;
+        int unit = 0;
+        while (value >= 1024 && unit < 4) {
+            value /= 1024;
+            ++unit;
+        }
+        std::ostringstream out;
+        out << std::fixed << std::setprecision(unit ? 1 : 0) << value << ' ' << units[unit];
+
+        return out.str();
+    }
+
+    std::string summary() const {
+        std::ostringstream out;
+        out << "--indexed " << line() << " in " << std::fixed << std::setprecision(3) << elapsed() << " s\n";
+        for (int i = 0; i < INDEX_PHASES_COUNT; ++i) {
+            out << "    " << std::left << std::setw(18) << index_phase_names[i] << phases_s[i] << " s\n";
+        }
+
+        return out.str();
+    }
+
+    std::string toJson() const {
+        std::ostringstream out;
+        out << "{\"docs\":" << docs
+            << ",\"input_bytes\":" << input_bytes
+            << ",\"seconds\":" << elapsed()
+            << ",\"vocabulary\":" << vocabulary
+            << ",\"trie_nodes\":" << trie_nodes
+            << ",\"trie_bytes\":" << trieBytes()
+            << ",\"peak_buffer_bytes\":" << buffer_bytes
+            << ",\"runs\":" << runs
+            << ",\"run_bytes\":" << run_bytes
+            << ",\"bitmaps\":" << bitmaps
+            << ",\"duplicates\":" << duplicates
+            << ",\"peak_rss_bytes\":" << peakRssBytes()
+            << ",\"bytes_written\":{";
+        bool first = true;
+        for (const IndexFileSize& file : index_files) {
+            out << (first ? "" : ",") << '"' << file.name << "\":" << fileSize(*file.path);
+            first = false;
+        }
+        out << "},\"phases_s\":{";
+        for (int i = 0; i < INDEX_PHASES_COUNT; ++i) {
+            out << (i ? "," : "") << '"' << index_phase_names[i] << "\":" << phases_s[i];
+        }
+        out << "}}";
+
+        return out.str();
+    }
+
+private:
+    double interval_s_;
+    Clock::time_point start_;
+    Clock::time_point last_report_;
+
+    explicit IndexTelemetry(double interval_s) : IndexTelemetry() {
+        interval_s_ = interval_s;
+    }
+};
@@ -0,0 +1,179 @@
+#pragma once
+#include "../trie/errors.hpp"
+#include "../trie/trie.hpp"
+#include "runs.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// tier.txt, the first tier of the index: for every term the postings of its highest documents, the ones
+// a query ranks first, at most perTerm of them. The results rank by document, not by score, so these are
+// the last postings of the list whatever their BM25 impact; FirstTierFollowsRanking fails if the two ever
+// differ. A query reads the small tier instead of the full posting lists when it is sure to find its k
+// results there, see Search::evaluateTier.
+//
+// File format: int64 terms count, int64 postings per term, then for every term by posting list position
+// its int64 posting list position and int64 offset of its entry from the start of the file; an entry is
+// the int64 df of the full list, the int64 postings in the tier and those postings.
+class TierWriter {
+public:
+    explicit TierWriter(int64_t per_term) : per_term_(per_term) {}
+
+    // From the index the file globals point to.
+    void run() {
+        std::fstream trie_tree;
+        trie_tree.open(trie_p, std::ios::binary | std::ios::in);
+        trie_tree.seekg(2 * sizeof(int64_t));
+        if (!trie_tree) {
+            fail("index is empty, run ./index first");
+        }
+        Trie trie;
+        trie.saveBackToRAM(trie_tree);
+        trie_tree.close();
+        std::vector<TermMatch> terms;
+        trie.match("*", std::numeric_limits<size_t>::max(), terms);
+        std::vector<int64_t> positions;
+        for (const TermMatch& term : terms) {
+            positions.push_back(term.posting_list_pos);
+        }
+        std::sort(positions.begin(), positions.end());
+
+        std::ifstream posting_lists(posting_lists_p, std::ios::binary);
+        std::vector<int64_t> dfs(positions.size());
+        std::vector<int64_t> offsets(positions.size());
+        int64_t offset = (2 + 2 * positions.size()) * sizeof(int64_t);
+        for (size_t i = 0; i < positions.size(); ++i) {
+            posting_lists.seekg(positions[i]);
+            posting_lists.read(reinterpret_cast<char*>(&dfs[i]), sizeof(int64_t));
+            offsets[i] = offset;
+            offset += 2 * sizeof(int64_t) + std::min(dfs[i], per_term_) * sizeof(DID);
+        }
+
+        std::ofstream tier(tier_p, std::ios::binary | std::ios::trunc);
+        int64_t header[2] = {static_cast<int64_t>(positions.size()), per_term_};
+        tier.write(reinterpret_cast<const char*>(header), sizeof(header));
+        for (size_t i = 0; i < positions.size(); ++i) {
+            tier.write(reinterpret_cast<const char*>(&positions[i]), sizeof(int64_t));
+            tier.write(reinterpret_cast<const char*>(&offsets[i]), sizeof(int64_t));
+        }
+        std::vector<DID> dids;
+        for (size_t i = 0; i < positions.size(); ++i) {
+            int64_t count = std::min(dfs[i], per_term_);
+            dids.resize(count);
+            posting_lists.seekg(positions[i] + sizeof(int64_t) + (dfs[i] - count) * sizeof(DID));
+            posting_lists.read(reinterpret_cast<char*>(dids.data()), count * sizeof(DID));
+            tier.write(reinterpret_cast<const char*>(&dfs[i]), sizeof(int64_t));
+            tier.write(reinterpret_cast<const char*>(&count), sizeof(int64_t));
+            tier.write(reinterpret_cast<const char*>(dids.data()), count * sizeof(DID));
+        }
+        if (!posting_lists || !tier) {
+            fail("can not write the first tier " + std::string(tier_p));
+        }
+    }
+
+private:
+    int64_t per_term_;
+};
+
+// The postings of a term in the first tier, the last count of its df postings.
+struct TierList {
+    const DID* dids;
+    int64_t count;
+    int64_t df;
+
+    // Every posting of the term on a document from here on is in the tier.
+    int64_t floor() const {
+        return count == df ? 0 : dids[0].ind;
+    }
+};
+
+// Read side of tier.txt, mapped into memory.
+class TierStore {
+public:
+    TierStore() : map_(MAP_FAILED), map_size_(0), terms_(0), table_(nullptr) {}
+
+    ~TierStore() {
+        close();
+    }
+
+    TierStore(const TierStore&) = delete;
+    TierStore& operator=(const TierStore&) = delete;
+
+    // False when the index has no first tier.
+    bool open(const std::string& path) {
+        close();
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st{};
+        fstat(fd, &st);
+        map_size_ = st.st_size;
+        if (map_size_ >= static_cast<int64_t>(2 * sizeof(int64_t))) {
+            map_ = mmap(nullptr, map_size_, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (map_ == MAP_FAILED) {
+            return false;
+        }
+
+        const int64_t* header = static_cast<const int64_t*>(map_);
+        terms_ = header[0];
+        if (terms_ < 0 || (2 + 2 * terms_) * static_cast<int64_t>(sizeof(int64_t)) > map_size_) {
+            close();
+            return false;
+        }
+        table_ = header + 2;
+
+        return true;
+    }
+
+    bool empty() const {
+        return terms_ == 0;
+    }
+
+    bool find(int64_t posting_list_pos, TierList& list) const {
+        int64_t low = 0;
+        int64_t high = terms_;
+        while (low < high) {
+            int64_t mid = (low + high) / 2;
+            if (table_[2 * mid] < posting_list_pos) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        if (low == terms_ || table_[2 * low] != posting_list_pos) {
+            return false;
+        }
+        const int64_t* entry = reinterpret_cast<const int64_t*>(static_cast<const char*>(map_) + table_[2 * low + 1]);
+        list.df = entry[0];
+        list.count = entry[1];
+        list.dids = reinterpret_cast<const DID*>(entry + 2);
+
+        return true;
+    }
+
+private:
+    void* map_;
+    int64_t map_size_;
+    int64_t terms_;
+    const int64_t* table_;
+
+    void close() {
+        if (map_ != MAP_FAILED) {
+            munmap(map_, map_size_);
+            map_ = MAP_FAILED;
+        }
+        terms_ = 0;
+    }
+};
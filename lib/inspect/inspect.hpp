@@ -0,0 +1,393 @@
+#pragma once
+#include "../index/analyzer.hpp"
+#include "../index/paths.hpp"
+#include "../index/roaring.hpp"
+#include "../index/runs.hpp"
+#include "../trie/errors.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <queue>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Counts of values in power of two ranges: 0, 1, 2-3, 4-7, ...
+class Log2Histogram {
+public:
+    void add(int64_t value) {
+        size_t bucket = std::bit_width(static_cast<uint64_t>(std::max<int64_t>(value, 0)));
+        if (counts_.size() <= bucket) {
+            counts_.resize(bucket + 1, 0);
+        }
+        ++counts_[bucket];
+    }
+
+    // The ranges holding values, as their lowest and highest value and count.
+    std::vector<std::vector<int64_t> > ranges() const {
+        std::vector<std::vector<int64_t> > rez;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            if (counts_[i] > 0) {
+                int64_t low = i == 0 ? 0 : int64_t(1) << (i - 1);
+                int64_t high = i == 0 ? 0 : (int64_t(1) << i) - 1;
+                rez.push_back({low, high, counts_[i]});
+            }
+        }
+
+        return rez;
+    }
+
+private:
+    std::vector<int64_t> counts_;
+};
+
+struct TermSize {
+    std::string term;
+    int64_t df;
+};
+
+struct IndexReport {
+    std::string dir;
+    int64_t documents = 0;
+    int64_t dlavg = 0;
+
+    int64_t terms = 0;
+    int64_t trie_nodes = 0;
+    int64_t trie_depth = 0;
+    int64_t trie_bytes = 0;
+
+    int64_t postings = 0;
+    int64_t postings_bytes = 0;
+    int64_t df_bytes = 0;
+    int64_t did_bytes = 0;
+    int64_t bitmaps = 0;
+    int64_t bitmap_bytes = 0;
+    int64_t unreferenced_bytes = 0;
+    // The DIDs with the documents and line positions delta coded and every field as a varint.
+    int64_t varint_did_bytes = 0;
+    Log2Histogram df;
+    std::vector<TermSize> longest;
+
+    Log2Histogram doc_lengths;
+    int64_t min_doc_length = 0;
+    int64_t max_doc_length = 0;
+
+    int64_t line_nums_bytes = 0;
+    int64_t line_numbers = 0;
+    int64_t line_offsets_bytes = 0;
+    int64_t paths_bytes = 0;
+    int64_t term_hash_bytes = 0;
+    int64_t tier_bytes = 0;
+
+    double bytesPerPosting() const {
+        return postings == 0 ? 0.0 : static_cast<double>(postings_bytes) / postings;
+    }
+
+    // Bytes of the DIDs a varint coding would not need.
+    int64_t paddingBytes() const {
+        return did_bytes - varint_did_bytes;
+    }
+
+    std::string toText() const {
+        std::ostringstream out;
+        out << "index: " << dir << '\n'
+            << "documents: " << documents << ", average length " << dlavg << ", lengths " << min_doc_length << " to "
+            << max_doc_length << '\n'
+            << "terms: " << terms << ", trie nodes " << trie_nodes << ", depth " << trie_depth << ", " << trie_bytes << " bytes\n"
+            << "postings: " << postings << ", " << postings_bytes << " bytes, " << bytesPerPosting() << " bytes per posting\n"
+            << "  dfs " << df_bytes << ", DIDs " << did_bytes << " (" << paddingBytes() << " padding against varints), "
+            << bitmaps << " bitmaps " << bitmap_bytes << ", unreferenced " << unreferenced_bytes << '\n'
+            << "line numbers: " << line_numbers << ", " << line_nums_bytes << " bytes\n"
+            << "line offsets: " << line_offsets_bytes << " bytes, paths " << paths_bytes << " bytes, term hash "
+            << term_hash_bytes << " bytes, first tier " << tier_bytes << " bytes\n";
+        out << "df distribution:\n";
+        printRanges(out, df);
+        out << "document length distribution:\n";
+        printRanges(out, doc_lengths);
+        out << "longest posting lists:\n";
+        for (const TermSize& term : longest) {
+            out << "  " << term.term << ' ' << term.df << '\n';
+        }
+
+        return out.str();
+    }
+
+    std::string toJson() const {
+        std::ostringstream out;
+        out << "{\"dir\":\"" << dir << '"'
+            << ",\"documents\":" << documents
+            << ",\"dlavg\":" << dlavg
+            << ",\"terms\":" << terms
+            << ",\"trie\":{\"nodes\":" << trie_nodes << ",\"depth\":" << trie_depth << ",\"bytes\":" << trie_bytes << '}'
+            << ",\"postings\":{\"count\":" << postings
+            << ",\"bytes\":" << postings_bytes
+            << ",\"bytes_per_posting\":" << bytesPerPosting()
+            << ",\"df_bytes\":" << df_bytes
+            << ",\"did_bytes\":" << did_bytes
+            << ",\"varint_did_bytes\":" << varint_did_bytes
+            << ",\"padding_bytes\":" << paddingBytes()
+            << ",\"bitmaps\":" << bitmaps
+            << ",\"bitmap_bytes\":" << bitmap_bytes
+            << ",\"unreferenced_bytes\":" << unreferenced_bytes << '}'
+            << ",\"df\":" << rangesJson(df)
+            << ",\"longest\":[";
+        for (size_t i = 0; i < longest.size(); ++i) {
+            out << (i ? "," : "") << "{\"term\":\"" << longest[i].term << "\",\"df\":" << longest[i].df << '}';
+        }
+        out << "],\"doc_lengths\":{\"min\":" << min_doc_length << ",\"max\":" << max_doc_length
+            << ",\"ranges\":" << rangesJson(doc_lengths) << '}'
+            << ",\"line_numbers\":{\"count\":" << line_numbers << ",\"bytes\":" << line_nums_bytes << '}'
+            << ",\"line_offsets_bytes\":" << line_offsets_bytes
+            << ",\"paths_bytes\":" << paths_bytes
+            << ",\"term_hash_bytes\":" << term_hash_bytes
+            << ",\"tier_bytes\":" << tier_bytes << '}';
+
+        return out.str();
+    }
+
+private:
+    static void printRanges(std::ostream& out, const Log2Histogram& histogram) {
+        for (const auto& range : histogram.ranges()) {
+            out << "  " << range[0];
+            if (range[1] != range[0]) {
+                out << '-' << range[1];
+            }
+            out << ": " << range[2] << '\n';
+        }
+    }
+
+    static std::string rangesJson(const Log2Histogram& histogram) {
+        std::ostringstream out;
+        out << '[';
+        bool first = true;
+        for (const auto& range : histogram.ranges()) {
+            out << (first ? "" : ",") << '[' << range[0] << ',' << range[1] << ',' << range[2] << ']';
+            first = false;
+        }
+        out << ']';
+
+        return out.str();
+    }
+};
+
+// Reads the files of a built index without loading them: the trie is walked as it is stored, the posting
+// lists are read once, in file order, a block at a time. The memory held is the vocabulary with the
+// posting list positions and one length per document.
+class IndexInspector {
+public:
+    static constexpr int64_t blockPostings = 4096;
+
+    explicit IndexInspector(std::string dir) : dir_(std::move(dir)) {
+        readTrie();
+    }
+
+    IndexReport inspect(int64_t top = 10) {
+        IndexReport report;
+        report.dir = dir_;
+        report.documents = doc_count_;
+        report.dlavg = dlavg_;
+        report.terms = vocabulary_.size();
+        report.trie_nodes = trie_nodes_;
+        report.trie_depth = trie_depth_;
+        report.trie_bytes = fileSize("trie.txt");
+        report.postings_bytes = fileSize("postinglists.txt");
+        report.line_nums_bytes = fileSize("numbersOfLines.txt");
+        report.line_offsets_bytes = fileSize("lineOffsets.txt");
+        report.paths_bytes = fileSize("files.txt");
+        report.term_hash_bytes = fileSize("termHash.txt");
+        report.tier_bytes = fileSize("tier.txt");
+
+        auto shorter = [](const TermSize& a, const TermSize& b) {
+            return a.df > b.df;
+        };
+        std::priority_queue<TermSize, std::vector<TermSize>, decltype(shorter)> longest(shorter);
+        std::vector<int64_t> doc_lengths(doc_count_, -1);
+
+        std::ifstream postings(file("postinglists.txt"), std::ios::binary);
+        std::vector<DID> block;
+        int64_t end = 0;
+        for (const auto& [pos, term] : vocabulary_) {
+            report.unreferenced_bytes += std::max<int64_t>(0, pos - end);
+            postings.seekg(pos);
+            int64_t df = 0;
+            postings.read(reinterpret_cast<char*>(&df), sizeof(int64_t));
+            report.df_bytes += sizeof(int64_t);
+            report.df.add(df);
+            report.postings += df;
+            longest.push({term, df});
+            if (static_cast<int64_t>(longest.size()) > top) {
+                longest.pop();
+            }
+
+            int64_t previous_doc = -1;
+            int64_t previous_lines = 0;
+            for (int64_t start = 0; start < df; start += blockPostings) {
+                block.resize(std::min(blockPostings, df - start));
+                postings.read(reinterpret_cast<char*>(block.data()), block.size() * sizeof(DID));
+                for (const DID& did : block) {
+                    report.varint_did_bytes += varintSize(did.ind - previous_doc) + varintSize(did.dl) + varintSize(did.tf) +
+                                               varintSize(did.pos_of_nums_lines - previous_lines);
+                    previous_doc = did.ind;
+                    previous_lines = did.pos_of_nums_lines;
+                    if (did.ind >= 0 && did.ind < doc_count_) {
+                        doc_lengths[did.ind] = did.dl;
+                    }
+                }
+            }
+            report.did_bytes += df * sizeof(DID);
+            if (denseTerm(df, doc_count_)) {
+                Roaring bitmap;
+                report.bitmap_bytes += bitmap.read(postings);
+                ++report.bitmaps;
+            }
+            if (!postings) {
+                fail("the posting list of " + term + " is cut short");
+            }
+            end = postings.tellg();
+        }
+        report.unreferenced_bytes += std::max<int64_t>(0, report.postings_bytes - end);
+        report.line_numbers = report.line_nums_bytes / static_cast<int64_t>(sizeof(int64_t)) - report.postings;
+
+        for (; !longest.empty(); longest.pop()) {
+            report.longest.push_back(longest.top());
+        }
+        std::reverse(report.longest.begin(), report.longest.end());
+
+        bool first = true;
+        for (int64_t length : doc_lengths) {
+            if (length < 0) {
+                continue;
+            }
+            report.doc_lengths.add(length);
+            report.min_doc_length = first ? length : std::min(report.min_doc_length, length);
+            report.max_doc_length = std::max(report.max_doc_length, length);
+            first = false;
+        }
+
+        return report;
+    }
+
+    // The postings of the term analyzed the way the index analyzed the documents: document, path, length,
+    // term frequency and line numbers.
+    void dumpTerm(const std::string& query, std::ostream& out) {
+        std::string term;
+        if (!Analyzer(AnalyzerOptions::load(file("analyzer.txt"))).analyze(query, term)) {
+            fail(query + " is not indexed by the analyzer of the index");
+        }
+        auto found = std::find_if(vocabulary_.begin(), vocabulary_.end(), [&term](const auto& entry) {
+            return entry.second == term;
+        });
+        if (found == vocabulary_.end()) {
+            fail("term was not found in trie: " + term);
+        }
+        PathStore paths;
+        if (!paths.open(file("files.txt"))) {
+            fail("the paths of the index are missing or of an older format");
+        }
+
+        std::ifstream postings(file("postinglists.txt"), std::ios::binary);
+        std::ifstream line_nums(file("numbersOfLines.txt"), std::ios::binary);
+        postings.seekg(found->first);
+        int64_t df = 0;
+        postings.read(reinterpret_cast<char*>(&df), sizeof(int64_t));
+        out << "TERM: '" << term << "' df " << df << '\n';
+        DID did;
+        for (int64_t i = 0; i < df && postings.read(reinterpret_cast<char*>(&did), sizeof(DID)); ++i) {
+            out << "  doc " << did.ind << " dl " << did.dl << " tf " << did.tf << " lines:";
+            line_nums.seekg(did.pos_of_nums_lines);
+            int64_t count = 0;
+            line_nums.read(reinterpret_cast<char*>(&count), sizeof(int64_t));
+            for (int64_t j = 0; j < count; ++j) {
+                int64_t line;
+                line_nums.read(reinterpret_cast<char*>(&line), sizeof(int64_t));
+                out << ' ' << line;
+            }
+            out << "  " << (did.ind >= 0 && did.ind < paths.size() ? paths.find(did.ind).path : "?") << '\n';
+        }
+    }
+
+private:
+    std::string dir_;
+    int64_t doc_count_ = 0;
+    int64_t dlavg_ = 0;
+    int64_t trie_nodes_ = 0;
+    int64_t trie_depth_ = 0;
+    // Posting list position and term, by position.
+    std::vector<std::pair<int64_t, std::string> > vocabulary_;
+
+    std::string file(const char* name) const {
+        return (std::filesystem::path(dir_) / name).string();
+    }
+
+    int64_t fileSize(const char* name) const {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(file(name), ec);
+
+        return ec ? 0 : static_cast<int64_t>(size);
+    }
+
+    static int64_t varintSize(int64_t value) {
+        int64_t rez = 1;
+        for (uint64_t v = value; v >= 0x80; v >>= 7) {
+            ++rez;
+        }
+
+        return rez;
+    }
+
+    // The trie is stored depth first, every node as its symbol, posting list position, line numbers
+    // position and children count; a stack of the children left to read rebuilds the terms.
+    void readTrie() {
+        std::ifstream trie(file("trie.txt"), std::ios::binary);
+        trie.read(reinterpret_cast<char*>(&doc_count_), sizeof(int64_t));
+        trie.read(reinterpret_cast<char*>(&dlavg_), sizeof(int64_t));
+        if (!trie) {
+            fail("index is empty, run ./index first");
+        }
+
+        std::vector<uint64_t> left;
+        std::string word;
+        auto node = [&](bool root) {
+            char symbol;
+            int64_t posting_list_pos;
+            int64_t line_nums_pos;
+            uint64_t children;
+            trie.read(&symbol, sizeof(char));
+            trie.read(reinterpret_cast<char*>(&posting_list_pos), sizeof(int64_t));
+            trie.read(reinterpret_cast<char*>(&line_nums_pos), sizeof(int64_t));
+            trie.read(reinterpret_cast<char*>(&children), sizeof(uint64_t));
+            if (!trie) {
+                fail("the trie of the index is cut short");
+            }
+            if (!root) {
+                word.push_back(symbol);
+            }
+            ++trie_nodes_;
+            trie_depth_ = std::max<int64_t>(trie_depth_, word.size());
+            if (posting_list_pos != -1) {
+                vocabulary_.push_back({posting_list_pos, word});
+            }
+            left.push_back(children);
+        };
+
+        node(true);
+        while (!left.empty()) {
+            if (left.back() == 0) {
+                left.pop_back();
+                if (!left.empty()) {
+                    word.pop_back();
+                }
+                continue;
+            }
+            --left.back();
+            node(false);
+        }
+        std::sort(vocabulary_.begin(), vocabulary_.end());
+    }
+};
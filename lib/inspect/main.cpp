@@ -0,0 +1,36 @@
+#include "../index/generations.hpp"
+#include "inspect.hpp"
+
+int main(int argc, char* argv[]) {
+    IndexGenerations generations = IndexGenerations::fromIndexDir();
+    std::string dir;
+    std::string term;
+    int64_t top = 10;
+    bool json = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--index" && i + 1 < argc) {
+            generations = IndexGenerations(argv[++i]);
+        } else if (arg == "--dir" && i + 1 < argc) {
+            dir = argv[++i];
+        } else if (arg == "--term" && i + 1 < argc) {
+            term = argv[++i];
+        } else if (arg == "--top" && i + 1 < argc) {
+            top = std::stoll(argv[++i]);
+        } else if (arg == "--json") {
+            json = true;
+        } else {
+            std::cerr << "--unknown option: " << arg << '\n';
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    IndexInspector inspector(dir.empty() ? generations.currentDir() : dir);
+    if (!term.empty()) {
+        inspector.dumpTerm(term, std::cout);
+        return 0;
+    }
+    IndexReport report = inspector.inspect(top);
+    std::cout << (json ? report.toJson() + '\n' : report.toText());
+}
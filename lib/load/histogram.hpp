@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+// Latencies in nanoseconds counted in buckets of a constant relative width, the way HdrHistogram does:
+// values below 2 * subBuckets are counted exactly, every next power of two is split into subBuckets
+// buckets, so a reported value is within 1 / subBuckets of a recorded one at any magnitude. The counts
+// of histograms of the same layout simply add up.
+class LatencyHistogram {
+public:
+    static const int64_t subBuckets = 128;
+
+    LatencyHistogram() : counts_(bucketOf(std::numeric_limits<int64_t>::max()) + 1, 0) {}
+
+    void record(int64_t value) {
+        value = std::max<int64_t>(value, 0);
+        ++counts_[bucketOf(value)];
+        ++total_;
+        sum_ += value;
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    void merge(const LatencyHistogram& other) {
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        sum_ += other.sum_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    int64_t count() const {
+        return total_;
+    }
+
+    int64_t min() const {
+        return total_ == 0 ? 0 : min_;
+    }
+
+    int64_t max() const {
+        return max_;
+    }
+
+    double mean() const {
+        return total_ == 0 ? 0.0 : static_cast<double>(sum_) / total_;
+    }
+
+    // The smallest value at least percent of the recorded values are at most, up to the bucket width.
+    int64_t percentile(double percent) const {
+        if (total_ == 0) {
+            return 0;
+        }
+        int64_t rank = std::max<int64_t>(1, static_cast<int64_t>(percent / 100 * total_ + 0.5));
+        int64_t seen = 0;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            seen += counts_[i];
+            if (seen >= rank) {
+                return std::min(highest(i), max_);
+            }
+        }
+
+        return max_;
+    }
+
+    // Buckets holding values, as the highest value of the bucket and its count.
+    std::vector<std::pair<int64_t, int64_t> > buckets() const {
+        std::vector<std::pair<int64_t, int64_t> > rez;
+        for (size_t i = 0; i < counts_.size(); ++i) {
+            if (counts_[i] > 0) {
+                rez.push_back({highest(i), counts_[i]});
+            }
+        }
+
+        return rez;
+    }
+
+private:
+    std::vector<int64_t> counts_;
+    int64_t total_ = 0;
+    int64_t sum_ = 0;
+    int64_t min_ = std::numeric_limits<int64_t>::max();
+    int64_t max_ = 0;
+
+    static size_t bucketOf(int64_t value) {
+        if (value < 2 * subBuckets) {
+            return value;
+        }
+        int shift = std::bit_width(static_cast<uint64_t>(value)) - std::bit_width(static_cast<uint64_t>(2 * subBuckets - 1));
+
+        return (shift + 1) * subBuckets + (value >> shift) - subBuckets;
+    }
+
+    static int64_t highest(size_t bucket) {
+        if (bucket < 2 * subBuckets) {
+            return bucket;
+        }
+        int shift = bucket / subBuckets - 1;
+        int64_t lowest = static_cast<int64_t>(bucket % subBuckets + subBuckets) << shift;
+
+        return lowest + (int64_t(1) << shift) - 1;
+    }
+};
@@ -0,0 +1,217 @@
+#pragma once
+#include "../engine/engine.hpp"
+#include "../index/generations.hpp"
+#include "../search/snapshot.hpp"
+#include "../trie/errors.hpp"
+#include "histogram.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+struct LoadOptions {
+    int64_t concurrency = 1;
+    // Requests sent, ignored by a closed loop running for a duration.
+    int64_t requests = 1000;
+    double duration_s = 0;
+    // Queries per second arriving as a Poisson process, an open loop; 0 is a closed loop where every
+    // worker sends its next query when the previous one is answered.
+    double rate = 0;
+    int64_t k = 10;
+    bool pin = false;
+    uint64_t seed = 42;
+};
+
+struct LoadReport {
+    LoadOptions options;
+    int64_t requests = 0;
+    int64_t errors = 0;
+    double elapsed_s = 0;
+    LatencyHistogram latency;
+
+    std::string toJson() const {
+        auto us = [](int64_t ns) {
+            return ns / 1000.0;
+        };
+        std::ostringstream out;
+        out << "{\"mode\":\"" << (options.rate > 0 ? "open" : "closed") << '"'
+            << ",\"concurrency\":" << options.concurrency
+            << ",\"rate\":" << options.rate
+            << ",\"pinned\":" << (options.pin ? "true" : "false")
+            << ",\"requests\":" << requests
+            << ",\"errors\":" << errors
+            << ",\"elapsed_s\":" << elapsed_s
+            << ",\"qps\":" << (elapsed_s > 0 ? requests / elapsed_s : 0.0)
+            << ",\"latency_us\":{\"min\":" << us(latency.min())
+            << ",\"mean\":" << latency.mean() / 1000
+            << ",\"p50\":" << us(latency.percentile(50))
+            << ",\"p95\":" << us(latency.percentile(95))
+            << ",\"p99\":" << us(latency.percentile(99))
+            << ",\"p99.9\":" << us(latency.percentile(99.9))
+            << ",\"max\":" << us(latency.max()) << '}'
+            << ",\"histogram_us\":[";
+        bool first = true;
+        for (const auto& [value, count] : latency.buckets()) {
+            out << (first ? "" : ",") << '[' << us(value) << ',' << count << ']';
+            first = false;
+        }
+        out << "]}";
+
+        return out.str();
+    }
+};
+
+// One query per line, empty lines skipped.
+inline std::vector<std::string> readQueryLog(const std::string& path) {
+    std::ifstream log(path);
+    if (!log) {
+        fail("can not open the query log: " + path);
+    }
+    std::vector<std::string> rez;
+    std::string query;
+    while (std::getline(log, query)) {
+        if (!query.empty()) {
+            rez.push_back(query);
+        }
+    }
+
+    return rez;
+}
+
+// Generates count queries of 1 to max_terms terms joined by AND or OR, a term drawn with probability falling as
+// 1 / rank^exponent of its document frequency, the way query terms follow the popularity of terms.
+inline std::vector<std::string> zipfQueries(const std::string& root, int64_t count, int64_t max_terms, double exponent, uint64_t seed) {
+    IndexGenerations generations(root);
+    IndexSnapshot index(generations.currentDir(), generations.current(), 0, 0);
+    std::vector<TermMatch> terms;
+    index.dictionary().match("*", std::numeric_limits<size_t>::max(), terms);
+    if (terms.empty()) {
+        fail("the index has no terms");
+    }
+
+    int fd = ::open(index.posting_lists.c_str(), O_RDONLY);
+    std::vector<std::pair<int64_t, std::string> > by_df;
+    for (const TermMatch& term : terms) {
+        int64_t df = 0;
+        if (pread(fd, &df, sizeof(int64_t), term.posting_list_pos) != sizeof(int64_t)) {
+            df = 0;
+        }
+        by_df.push_back({df, term.term});
+    }
+    ::close(fd);
+    std::stable_sort(by_df.begin(), by_df.end(), [](const auto& a, const auto& b) {
+        return a.first > b.first;
+    });
+
+    std::vector<double> cumulative;
+    double sum = 0;
+    for (size_t rank = 1; rank <= by_df.size(); ++rank) {
+        sum += 1.0 / std::pow(rank, exponent);
+        cumulative.push_back(sum);
+    }
+
+    std::mt19937_64 random(seed);
+    std::uniform_real_distribution<double> uniform(0, sum);
+    std::uniform_int_distribution<int64_t> length(1, std::max<int64_t>(1, max_terms));
+    std::bernoulli_distribution conjunction(0.5);
+    std::vector<std::string> rez;
+    for (int64_t i = 0; i < count; ++i) {
+        std::string query;
+        for (int64_t j = length(random); j > 0; --j) {
+            size_t rank = std::lower_bound(cumulative.begin(), cumulative.end(), uniform(random)) - cumulative.begin();
+            if (!query.empty()) {
+                query += conjunction(random) ? " AND " : " OR ";
+            }
+            query += by_df[std::min(rank, by_df.size() - 1)].second;
+        }
+        rez.push_back(query);
+    }
+
+    return rez;
+}
+
+// Sends the queries, in turn, to the index from options.concurrency threads. In an open loop a request
+// is due at its arrival time whether or not the workers are free, and its latency counts from then, so
+// a slow engine is not hidden by sending fewer requests (coordinated omission).
+inline LoadReport runLoad(Index& index, const std::vector<std::string>& queries, const LoadOptions& options) {
+    using Clock = std::chrono::steady_clock;
+    LoadReport report;
+    report.options = options;
+    if (queries.empty()) {
+        return report;
+    }
+
+    int64_t requests = options.requests;
+    bool timed = options.duration_s > 0;
+    if (timed) {
+        requests = options.rate > 0 ? static_cast<int64_t>(options.rate * options.duration_s) : std::numeric_limits<int64_t>::max();
+    }
+    std::vector<int64_t> arrivals;
+    if (options.rate > 0) {
+        std::mt19937_64 random(options.seed);
+        std::exponential_distribution<double> gap(options.rate);
+        double at = 0;
+        for (int64_t i = 0; i < requests; ++i) {
+            arrivals.push_back(static_cast<int64_t>(at * 1e9));
+            at += gap(random);
+        }
+    }
+
+    int64_t concurrency = std::max<int64_t>(1, options.concurrency);
+    std::vector<LatencyHistogram> latencies(concurrency);
+    std::vector<int64_t> errors(concurrency, 0);
+    std::atomic<int64_t> next{0};
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + std::chrono::nanoseconds(static_cast<int64_t>(options.duration_s * 1e9));
+
+    std::vector<std::thread> workers;
+    for (int64_t w = 0; w < concurrency; ++w) {
+        workers.emplace_back([&, w] {
+            if (options.pin) {
+                cpu_set_t cpus;
+                CPU_ZERO(&cpus);
+                CPU_SET(w % std::max(1u, std::thread::hardware_concurrency()), &cpus);
+                pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+            }
+            while (true) {
+                int64_t i = next++;
+                if (i >= requests || (timed && options.rate <= 0 && Clock::now() >= deadline)) {
+                    return;
+                }
+                Clock::time_point sent = Clock::now();
+                if (options.rate > 0) {
+                    sent = start + std::chrono::nanoseconds(arrivals[i]);
+                    std::this_thread::sleep_until(sent);
+                }
+                QueryResults results = index.search(queries[i % queries.size()], options.k);
+                latencies[w].record(std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - sent).count());
+                errors[w] += !results.ok();
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+
+    report.elapsed_s = std::chrono::duration<double>(Clock::now() - start).count();
+    for (int64_t w = 0; w < concurrency; ++w) {
+        report.latency.merge(latencies[w]);
+        report.errors += errors[w];
+    }
+    report.requests = report.latency.count();
+
+    return report;
+}
@@ -0,0 +1,64 @@
+#include "load.hpp"
+
+int main(int argc, char* argv[]) {
+    std::string root = IndexGenerations::fromIndexDir().root().string();
+    std::string query_log;
+    int64_t zipf = 0;
+    int64_t max_terms = 2;
+    double exponent = 1.0;
+    IndexOptions index_options;
+    LoadOptions options;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--index" && i + 1 < argc) {
+            root = argv[++i];
+        } else if (arg == "--queries" && i + 1 < argc) {
+            query_log = argv[++i];
+        } else if (arg == "--zipf" && i + 1 < argc) {
+            zipf = std::stoll(argv[++i]);
+        } else if (arg == "--terms" && i + 1 < argc) {
+            max_terms = std::stoll(argv[++i]);
+        } else if (arg == "--exponent" && i + 1 < argc) {
+            exponent = std::stod(argv[++i]);
+        } else if (arg == "--concurrency" && i + 1 < argc) {
+            options.concurrency = std::stoll(argv[++i]);
+        } else if (arg == "--requests" && i + 1 < argc) {
+            options.requests = std::stoll(argv[++i]);
+        } else if (arg == "--duration" && i + 1 < argc) {
+            options.duration_s = std::stod(argv[++i]);
+        } else if (arg == "--rate" && i + 1 < argc) {
+            options.rate = std::stod(argv[++i]);
+        } else if (arg == "--k" && i + 1 < argc) {
+            options.k = std::stoll(argv[++i]);
+        } else if (arg == "--seed" && i + 1 < argc) {
+            options.seed = std::stoull(argv[++i]);
+        } else if (arg == "--pin") {
+            options.pin = true;
+        } else if (arg == "--no-result-cache") {
+            index_options.result_cache_bytes = 0;
+        } else {
+            std::cerr << "--unknown option: " << arg << '\n';
+            std::exit(EXIT_FAILURE);
+        }
+    }
+    if (query_log.empty() == (zipf == 0)) {
+        std::cerr << "--give either --queries FILE or --zipf COUNT" << '\n';
+        std::exit(EXIT_FAILURE);
+    }
+
+    std::vector<std::string> queries =
+        query_log.empty() ? zipfQueries(root, zipf, max_terms, exponent, options.seed) : readQueryLog(query_log);
+    if (queries.empty()) {
+        std::cerr << "--no queries to send" << '\n';
+        std::exit(EXIT_FAILURE);
+    }
+
+    Index index;
+    std::string error = index.open(root, index_options);
+    if (!error.empty()) {
+        std::cerr << "--" << error << '\n';
+        std::exit(EXIT_FAILURE);
+    }
+    std::cout << runLoad(index, queries, options).toJson() << '\n';
+}
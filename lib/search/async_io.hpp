@@ -0,0 +1,373 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#define SEARCH_HAVE_IO_URING 1
+#endif
+
+enum class IoBackend {
+    AUTO,
+    URING,
+    THREADS,
+    SYNC,
+};
+
+// Reads of index file ranges that are queued with submit(), sent together by flush() and waited
+// for one by one, so the reads of a query are in flight at the same time and evaluation runs
+// while the following ones are being read.
+class AsyncReader {
+public:
+    virtual ~AsyncReader() = default;
+
+    // Picks io_uring when the kernel allows it, a pool of pread threads otherwise.
+    static std::unique_ptr<AsyncReader> create(IoBackend backend);
+
+    virtual const char* name() const = 0;
+
+    // Returns the ticket of the read, dest must stay valid until it is waited for.
+    size_t submit(int fd, int64_t offset, char* dest, int64_t size) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        size_t ticket = results_.size();
+        results_.push_back(pending);
+        ++submitted_;
+        enqueue({fd, offset, dest, size, ticket});
+
+        return ticket;
+    }
+
+    virtual void flush() = 0;
+
+    // Bytes read by the ticket's request.
+    int64_t wait(size_t ticket) {
+        flush();
+
+        return waitFor(ticket);
+    }
+
+    // Forgets the finished tickets, called between queries when nothing is in flight.
+    void reset() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        results_.clear();
+    }
+
+    int64_t submitted() const {
+        return submitted_;
+    }
+
+protected:
+    struct Request {
+        int fd;
+        int64_t offset;
+        char* dest;
+        int64_t size;
+        size_t ticket;
+    };
+
+    static constexpr int64_t pending = -2;
+
+    std::mutex mutex_;
+    std::condition_variable done_;
+    std::vector<int64_t> results_;
+    int64_t submitted_ = 0;
+
+    // Called with mutex_ held.
+    virtual void enqueue(const Request& request) = 0;
+
+    virtual int64_t waitFor(size_t ticket) = 0;
+
+    static int64_t readFully(const Request& request) {
+        int64_t done = 0;
+        while (done < request.size) {
+            ssize_t n = pread(request.fd, request.dest + done, request.size - done, request.offset + done);
+            if (n <= 0) {
+                break;
+            }
+            done += n;
+        }
+
+        return done;
+    }
+};
+
+// pread on a pool of threads, or in the calling thread at flush() when there are no threads.
+class ThreadPoolReader : public AsyncReader {
+public:
+    explicit ThreadPoolReader(size_t threads) : stop_(false) {
+        for (size_t i = 0; i < threads; ++i) {
+            workers_.emplace_back([this] {
+                work();
+            });
+        }
+    }
+
+    ~ThreadPoolReader() override {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        ready_.notify_all();
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    const char* name() const override {
+        return workers_.empty() ? "sync" : "threads";
+    }
+
+    void flush() override {
+        std::deque<Request> batch;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (queued_.empty()) {
+                return;
+            }
+            if (!workers_.empty()) {
+                ready_.notify_all();
+                return;
+            }
+            batch.swap(queued_);
+        }
+        for (const Request& request : batch) {
+            int64_t n = readFully(request);
+            std::lock_guard<std::mutex> lock(mutex_);
+            results_[request.ticket] = n;
+        }
+    }
+
+protected:
+    void enqueue(const Request& request) override {
+        queued_.push_back(request);
+    }
+
+    int64_t waitFor(size_t ticket) override {
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this, ticket] {
+            return results_[ticket] != pending;
+        });
+
+        return results_[ticket];
+    }
+
+private:
+    std::vector<std::thread> workers_;
+    std::deque<Request> queued_;
+    std::condition_variable ready_;
+    bool stop_;
+
+    void work() {
+        while (true) {
+            Request request;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                ready_.wait(lock, [this] {
+                    return stop_ || !queued_.empty();
+                });
+                if (stop_) {
+                    return;
+                }
+                request = queued_.front();
+                queued_.pop_front();
+            }
+            int64_t n = readFully(request);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                results_[request.ticket] = n;
+            }
+            done_.notify_all();
+        }
+    }
+};
+
+#ifdef SEARCH_HAVE_IO_URING
+// io_uring through the raw syscalls: reads are written into the submission ring by submit(),
+// handed to the kernel by one io_uring_enter in flush() and reaped from the completion ring.
+class UringReader : public AsyncReader {
+public:
+    static constexpr unsigned entries = 256;
+
+    UringReader() : ring_fd_(-1), sq_ptr_(MAP_FAILED), cq_ptr_(MAP_FAILED), sqes_(MAP_FAILED), queued_(0), in_flight_(0) {
+        io_uring_params params{};
+        ring_fd_ = syscall(__NR_io_uring_setup, entries, &params);
+        if (ring_fd_ < 0) {
+            return;
+        }
+
+        sq_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) {
+            sq_size_ = cq_size_ = std::max(sq_size_, cq_size_);
+        }
+        sq_ptr_ = mmap(nullptr, sq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+        cq_ptr_ = single_mmap ? sq_ptr_
+                              : mmap(nullptr, cq_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+        sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+        sqes_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+        if (sq_ptr_ == MAP_FAILED || cq_ptr_ == MAP_FAILED || sqes_ == MAP_FAILED) {
+            close();
+            return;
+        }
+
+        char* sq = static_cast<char*>(sq_ptr_);
+        sq_tail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        sq_mask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        sq_array_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        sq_entries_ = params.sq_entries;
+
+        char* cq = static_cast<char*>(cq_ptr_);
+        cq_head_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        cq_tail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        cq_mask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+    }
+
+    ~UringReader() override {
+        close();
+    }
+
+    bool ok() const {
+        return ring_fd_ >= 0;
+    }
+
+    const char* name() const override {
+        return "uring";
+    }
+
+    void flush() override {
+        while (queued_ > 0) {
+            int n = syscall(__NR_io_uring_enter, ring_fd_, queued_, 0, 0, nullptr, 0);
+            if (n < 0) {
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+                    reap(true);
+                    continue;
+                }
+                break;
+            }
+            queued_ -= n;
+            in_flight_ += n;
+        }
+    }
+
+protected:
+    void enqueue(const Request& request) override {
+        while (queued_ + in_flight_ >= sq_entries_) {
+            flush();
+            reap(true);
+        }
+
+        unsigned tail = *sq_tail_;
+        unsigned index = tail & sq_mask_;
+        io_uring_sqe* sqe = static_cast<io_uring_sqe*>(sqes_) + index;
+        std::memset(sqe, 0, sizeof(io_uring_sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = request.fd;
+        sqe->off = request.offset;
+        sqe->addr = reinterpret_cast<uint64_t>(request.dest);
+        sqe->len = request.size;
+        sqe->user_data = request.ticket;
+        sq_array_[index] = index;
+        __atomic_store_n(sq_tail_, tail + 1, __ATOMIC_RELEASE);
+        ++queued_;
+        requests_.resize(std::max(requests_.size(), request.ticket + 1));
+        requests_[request.ticket] = request;
+    }
+
+    int64_t waitFor(size_t ticket) override {
+        while (results_[ticket] == pending) {
+            reap(true);
+        }
+
+        return results_[ticket];
+    }
+
+private:
+    int ring_fd_;
+    void* sq_ptr_;
+    void* cq_ptr_;
+    void* sqes_;
+    size_t sq_size_;
+    size_t cq_size_;
+    size_t sqes_size_;
+    unsigned* sq_tail_;
+    unsigned sq_mask_;
+    unsigned* sq_array_;
+    unsigned sq_entries_;
+    unsigned* cq_head_;
+    unsigned* cq_tail_;
+    unsigned cq_mask_;
+    io_uring_cqe* cqes_;
+    unsigned queued_;
+    unsigned in_flight_;
+    std::vector<Request> requests_;
+
+    void reap(bool block) {
+        unsigned head = *cq_head_;
+        if (block && head == __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE)) {
+            flush();
+            syscall(__NR_io_uring_enter, ring_fd_, 0, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        }
+        unsigned tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+        for (; head != tail; ++head) {
+            io_uring_cqe* cqe = &cqes_[head & cq_mask_];
+            const Request& request = requests_[cqe->user_data];
+            // Errors and short reads are completed with pread, the kernel may not support the opcode.
+            results_[cqe->user_data] = cqe->res == request.size ? cqe->res : readFully(request);
+            --in_flight_;
+        }
+        __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+    }
+
+    void close() {
+        if (sqes_ != MAP_FAILED) {
+            munmap(sqes_, sqes_size_);
+        }
+        if (cq_ptr_ != MAP_FAILED && cq_ptr_ != sq_ptr_) {
+            munmap(cq_ptr_, cq_size_);
+        }
+        if (sq_ptr_ != MAP_FAILED) {
+            munmap(sq_ptr_, sq_size_);
+        }
+        if (ring_fd_ >= 0) {
+            ::close(ring_fd_);
+        }
+        ring_fd_ = -1;
+        sq_ptr_ = cq_ptr_ = sqes_ = MAP_FAILED;
+    }
+};
+#endif
+
+const size_t readerThreads = 4;
+
+inline std::unique_ptr<AsyncReader> AsyncReader::create(IoBackend backend) {
+#ifdef SEARCH_HAVE_IO_URING
+    if (backend == IoBackend::AUTO || backend == IoBackend::URING) {
+        std::unique_ptr<UringReader> uring(new UringReader());
+        if (uring->ok()) {
+            return uring;
+        }
+    }
+#endif
+    if (backend == IoBackend::SYNC) {
+        return std::unique_ptr<AsyncReader>(new ThreadPoolReader(0));
+    }
+
+    return std::unique_ptr<AsyncReader>(new ThreadPoolReader(readerThreads));
+}
@@ -0,0 +1,184 @@
+#pragma once
+#include "../index/runs.hpp"
+#include "../trie/trie.hpp"
+
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+// Least recently used entries are evicted once the entries take more than capacity bytes, as given to
+// put(). Values are shared, so an entry evicted while a query still uses it stays alive until then.
+// A capacity of 0 disables the cache. Safe to use from several threads, the Searches sharing one
+// snapshot share its caches.
+template <typename Key, typename Value, typename Hash = std::hash<Key> >
+class LruCache {
+public:
+    explicit LruCache(int64_t capacity) : capacity_(capacity), bytes_(0), hits_(0), misses_(0), evictions_(0) {}
+
+    std::shared_ptr<const Value> get(const Key& key) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (capacity_ == 0) {
+            return nullptr;
+        }
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            ++misses_;
+            return nullptr;
+        }
+        ++hits_;
+        entries_.splice(entries_.begin(), entries_, it->second);
+
+        return it->second->value;
+    }
+
+    void put(const Key& key, std::shared_ptr<const Value> value, int64_t bytes) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (bytes > capacity_) {
+            return;
+        }
+        erase(key);
+        entries_.push_front({key, std::move(value), bytes});
+        index_[key] = entries_.begin();
+        bytes_ += bytes;
+        evict();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        entries_.clear();
+        index_.clear();
+        bytes_ = 0;
+    }
+
+    void setCapacity(int64_t capacity) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        capacity_ = capacity;
+        evict();
+    }
+
+    int64_t capacity() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return capacity_;
+    }
+
+    int64_t bytes() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return bytes_;
+    }
+
+    int64_t size() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return entries_.size();
+    }
+
+    int64_t hits() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return hits_;
+    }
+
+    int64_t misses() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return misses_;
+    }
+
+    int64_t evictions() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return evictions_;
+    }
+
+private:
+    struct Entry {
+        Key key;
+        std::shared_ptr<const Value> value;
+        int64_t bytes;
+    };
+
+    mutable std::mutex mutex_;
+    int64_t capacity_;
+    int64_t bytes_;
+    int64_t hits_;
+    int64_t misses_;
+    int64_t evictions_;
+    std::list<Entry> entries_;
+    std::unordered_map<Key, typename std::list<Entry>::iterator, Hash> index_;
+
+    void erase(const Key& key) {
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            bytes_ -= it->second->bytes;
+            entries_.erase(it->second);
+            index_.erase(it);
+        }
+    }
+
+    void evict() {
+        while (bytes_ > capacity_ && !entries_.empty()) {
+            bytes_ -= entries_.back().bytes;
+            index_.erase(entries_.back().key);
+            entries_.pop_back();
+            ++evictions_;
+        }
+    }
+};
+
+// A block of postingBlockSize DIDs of a posting list, keyed by the position of the list and the
+// index of the first DID of the block. The df is kept with every block, the first one replaces the read of it.
+struct BlockKey {
+    int64_t posting_list_pos;
+    int64_t start;
+
+    bool operator==(const BlockKey& other) const {
+        return posting_list_pos == other.posting_list_pos && start == other.start;
+    }
+};
+
+struct BlockKeyHash {
+    size_t operator()(const BlockKey& key) const {
+        return std::hash<int64_t>()(key.posting_list_pos * 31 + key.start);
+    }
+};
+
+struct PostingBlock {
+    int64_t df;
+    std::vector<DID> dids;
+
+    int64_t memory() const {
+        return sizeof(PostingBlock) + sizeof(BlockKey) + dids.size() * sizeof(DID);
+    }
+};
+
+using BlockCache = LruCache<BlockKey, PostingBlock, BlockKeyHash>;
+
+// Changes whenever the dictionary or the posting lists in dir are rewritten, cached queries and blocks
+// of an older index are dropped when it does.
+inline int64_t indexGeneration(const std::filesystem::path& dir) {
+    int64_t rez = 0;
+    for (const char* global : {trie_p, posting_lists_p}) {
+        std::filesystem::path path = dir / std::filesystem::path(global).filename();
+        struct stat st{};
+        if (stat(path.c_str(), &st) != 0) {
+            continue;
+        }
+        for (int64_t part : {static_cast<int64_t>(st.st_ino), static_cast<int64_t>(st.st_size),
+                             static_cast<int64_t>(st.st_mtim.tv_sec), static_cast<int64_t>(st.st_mtim.tv_nsec)}) {
+            rez = rez * 1000003 + part;
+        }
+    }
+
+    return rez;
+}
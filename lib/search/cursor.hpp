@@ -0,0 +1,386 @@
+#pragma once
+#include "../index/roaring.hpp"
+#include "../index/runs.hpp"
+#include "async_io.hpp"
+#include "cache.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <vector>
+
+const int64_t endOfList = std::numeric_limits<int64_t>::max();
+
+// Postings are read from postinglists.txt in blocks of this many DIDs.
+const int64_t postingBlockSize = 128;
+
+inline double BM25(int64_t tf, int64_t dlavg, int64_t dl) {
+    double rez = 0.0;
+    double k = 1.2;
+    double b = 0.75;
+
+    for (int64_t t = 0; t < tf; ++t) {
+        rez += (tf * (k + 1)) / (tf + k * (1 - b + b * static_cast<double>(dl) / dlavg));
+    }
+
+    return rez;
+}
+
+// A posting of a displayed query term on a document: the term, by its index among the displayed
+// terms of the query, and the position of the numbers of the lines it is on.
+struct TermPosting {
+    int64_t term;
+    int64_t line_nums_pos;
+};
+
+// Iterates over the documents of a posting list (or of a combination of lists) in increasing order.
+class Cursor {
+public:
+    virtual ~Cursor() = default;
+
+    virtual int64_t doc() const = 0;
+
+    // Moves to the first document >= target.
+    virtual void advance(int64_t target) = 0;
+
+    // Score of the current document.
+    virtual double score() const = 0;
+
+    // Adds the postings of the displayed terms on the current document to out, so the results are
+    // displayed without reading the posting lists again.
+    virtual void postings(std::vector<TermPosting>& out) const {}
+
+    void next() {
+        if (doc() != endOfList) {
+            advance(doc() + 1);
+        }
+    }
+};
+
+// Posting list read block by block through the AsyncReader. The constructor only queues the read of
+// the df and the first block, open() waits for it; every loaded block queues the read of the next one,
+// so the following block is read while the current one is being scored.
+//
+// With a BlockCache the blocks found in it are not read, and the blocks read are added to it.
+class TermCursor : public Cursor {
+public:
+    TermCursor(AsyncReader& reader, int fd, int64_t posting_list_pos, int64_t dlavg, QueryStats& stats, double weight = 1.0,
+               BlockCache* cache = nullptr, int64_t term = -1)
+        : reader_(reader), fd_(fd), posting_list_pos_(posting_list_pos), dlavg_(dlavg), weight_(weight), stats_(stats),
+          cache_(cache), term_(term), bitmap_(nullptr), df_(0), block_start_(0), ind_(0), opened_(false), next_start_(-1) {
+        head_block_ = cached(0);
+        if (head_block_ == nullptr) {
+            head_.resize(sizeof(int64_t) + postingBlockSize * sizeof(DID));
+            head_ticket_ = reader_.submit(fd_, posting_list_pos_, head_.data(), head_.size());
+        }
+    }
+
+    ~TermCursor() override {
+        if (!opened_ && head_block_ == nullptr) {
+            reader_.wait(head_ticket_);
+        }
+        dropPrefetch();
+    }
+
+    void open() {
+        if (opened_) {
+            return;
+        }
+        opened_ = true;
+        if (head_block_ != nullptr) {
+            df_ = head_block_->df;
+            block_ = head_block_->dids;
+            head_block_.reset();
+            loaded();
+            return;
+        }
+
+        reader_.wait(head_ticket_);
+        std::memcpy(&df_, head_.data(), sizeof(int64_t));
+        stats_.bytes_read[POSTINGS] += sizeof(int64_t);
+
+        block_.resize(std::min(postingBlockSize, df_));
+        std::memcpy(block_.data(), head_.data() + sizeof(int64_t), block_.size() * sizeof(DID));
+        head_.clear();
+        head_.shrink_to_fit();
+        stats_.bytes_read[POSTINGS] += block_.size() * sizeof(DID);
+        store(0, block_);
+        loaded();
+    }
+
+    int64_t df() const {
+        return df_;
+    }
+
+    int64_t doc() const override {
+        return ind_ < df_ ? block_[ind_ - block_start_].ind : endOfList;
+    }
+
+    const DID& posting() const {
+        return block_[ind_ - block_start_];
+    }
+
+    // The bitmap of a dense term gives the position of any document in the list, so advance jumps
+    // straight to the block holding the target instead of reading the blocks before it.
+    void useBitmap(const Roaring* bitmap) {
+        bitmap_ = bitmap;
+    }
+
+    void advance(int64_t target) override {
+        if (bitmap_ != nullptr) {
+            int64_t ind = std::max(ind_, bitmap_->rank(target));
+            if (ind - ind_ > 1) {
+                stats_.postings_skipped += ind - ind_ - 1;
+            }
+            ind_ = ind;
+            if (ind_ < df_ && ind_ - block_start_ >= static_cast<int64_t>(block_.size())) {
+                readBlock(ind_);
+            }
+            return;
+        }
+
+        int64_t start = ind_;
+        while (ind_ < df_) {
+            if (ind_ - block_start_ == static_cast<int64_t>(block_.size())) {
+                readBlock(ind_);
+            }
+            if (block_[ind_ - block_start_].ind >= target) {
+                break;
+            }
+            ++ind_;
+        }
+        if (ind_ - start > 1) {
+            stats_.postings_skipped += ind_ - start - 1;
+        }
+    }
+
+    double score() const override {
+        const DID& dId = posting();
+
+        return weight_ * BM25(dId.tf, dlavg_, dId.dl);
+    }
+
+    void postings(std::vector<TermPosting>& out) const override {
+        if (term_ >= 0 && doc() != endOfList) {
+            out.push_back({term_, posting().pos_of_nums_lines});
+        }
+    }
+
+    double weight() const {
+        return weight_;
+    }
+
+    // Index of the term among the displayed terms of the query, -1 for an excluded one.
+    int64_t term() const {
+        return term_;
+    }
+
+    int64_t dlavg() const {
+        return dlavg_;
+    }
+
+    // Term at a time evaluation takes the list a block at a time: f gets the postings of every block
+    // left from the cursor on and their count, and the cursor ends past the list.
+    template <typename F>
+    void forEachBlock(F&& f) {
+        open();
+        while (ind_ < df_) {
+            if (ind_ - block_start_ == static_cast<int64_t>(block_.size())) {
+                readBlock(ind_);
+            }
+            int64_t end = block_start_ + block_.size();
+            f(block_.data() + (ind_ - block_start_), end - ind_);
+            ind_ = end;
+        }
+    }
+
+private:
+    AsyncReader& reader_;
+    int fd_;
+    int64_t posting_list_pos_;
+    int64_t dlavg_;
+    double weight_;
+    QueryStats& stats_;
+    BlockCache* cache_;
+    int64_t term_;
+    const Roaring* bitmap_;
+    int64_t df_;
+    int64_t block_start_;
+    int64_t ind_;
+    std::vector<DID> block_;
+
+    bool opened_;
+    std::vector<char> head_;
+    size_t head_ticket_;
+    std::shared_ptr<const PostingBlock> head_block_;
+
+    int64_t next_start_;
+    size_t next_ticket_;
+    bool next_cached_;
+    std::vector<DID> next_;
+
+    int64_t blockOffset(int64_t start) const {
+        return posting_list_pos_ + sizeof(int64_t) + start * sizeof(DID);
+    }
+
+    void readBlock(int64_t start) {
+        if (next_start_ == start) {
+            if (!next_cached_) {
+                reader_.wait(next_ticket_);
+                stats_.bytes_read[POSTINGS] += next_.size() * sizeof(DID);
+                store(start, next_);
+            }
+            next_start_ = -1;
+            block_.swap(next_);
+        } else if (auto block = cached(start)) {
+            dropPrefetch();
+            block_ = block->dids;
+        } else {
+            dropPrefetch();
+            block_.resize(std::min(postingBlockSize, df_ - start));
+            reader_.wait(reader_.submit(fd_, blockOffset(start), reinterpret_cast<char*>(block_.data()), block_.size() * sizeof(DID)));
+            stats_.bytes_read[POSTINGS] += block_.size() * sizeof(DID);
+            store(start, block_);
+        }
+        block_start_ = start;
+        loaded();
+    }
+
+    void loaded() {
+        stats_.postings_decoded += block_.size();
+
+        int64_t next = block_start_ + block_.size();
+        if (next < df_) {
+            next_start_ = next;
+            if (auto block = cached(next)) {
+                next_cached_ = true;
+                next_ = block->dids;
+                return;
+            }
+            next_cached_ = false;
+            next_.resize(std::min(postingBlockSize, df_ - next));
+            next_ticket_ = reader_.submit(fd_, blockOffset(next), reinterpret_cast<char*>(next_.data()), next_.size() * sizeof(DID));
+            reader_.flush();
+        }
+    }
+
+    // The buffer of a queued read must outlive it.
+    void dropPrefetch() {
+        if (next_start_ != -1) {
+            if (!next_cached_) {
+                reader_.wait(next_ticket_);
+            }
+            next_start_ = -1;
+        }
+    }
+
+    std::shared_ptr<const PostingBlock> cached(int64_t start) {
+        if (cache_ == nullptr) {
+            return nullptr;
+        }
+        auto block = cache_->get({posting_list_pos_, start});
+        ++(block ? stats_.block_cache_hits : stats_.block_cache_misses);
+
+        return block;
+    }
+
+    void store(int64_t start, const std::vector<DID>& dids) {
+        if (cache_ != nullptr && cache_->capacity() > 0) {
+            auto block = std::make_shared<PostingBlock>(PostingBlock{df_, dids});
+            cache_->put({posting_list_pos_, start}, block, block->memory());
+        }
+    }
+};
+
+// Union of a few cursors kept in a heap by current document, the score sums the cursors on it.
+class UnionCursor : public Cursor {
+public:
+    explicit UnionCursor(std::vector<std::unique_ptr<Cursor> > cursors) : cursors_(std::move(cursors)) {
+        for (size_t i = 0; i < cursors_.size(); ++i) {
+            if (cursors_[i]->doc() != endOfList) {
+                heap_.push({cursors_[i]->doc(), i});
+            }
+        }
+    }
+
+    int64_t doc() const override {
+        return heap_.empty() ? endOfList : heap_.top().first;
+    }
+
+    void advance(int64_t target) override {
+        while (!heap_.empty() && heap_.top().first < target) {
+            size_t i = heap_.top().second;
+            heap_.pop();
+            cursors_[i]->advance(target);
+            if (cursors_[i]->doc() != endOfList) {
+                heap_.push({cursors_[i]->doc(), i});
+            }
+        }
+    }
+
+    double score() const override {
+        double rez = 0.0;
+        for (const auto& cursor : cursors_) {
+            if (cursor->doc() == doc()) {
+                rez += cursor->score();
+            }
+        }
+
+        return rez;
+    }
+
+    void postings(std::vector<TermPosting>& out) const override {
+        for (const auto& cursor : cursors_) {
+            if (cursor->doc() == doc()) {
+                cursor->postings(out);
+            }
+        }
+    }
+
+private:
+    std::vector<std::unique_ptr<Cursor> > cursors_;
+    std::priority_queue<std::pair<int64_t, size_t>, std::vector<std::pair<int64_t, size_t> >,
+                        std::greater<std::pair<int64_t, size_t> > > heap_;
+};
+
+// Documents and scores computed ahead of evaluation, used when a union is too wide for a heap. The
+// postings of the displayed terms, when given, are kept by document as well.
+class ListCursor : public Cursor {
+public:
+    ListCursor(std::vector<int64_t> docs, std::vector<double> scores, std::vector<std::vector<TermPosting> > postings = {})
+        : docs_(std::move(docs)), scores_(std::move(scores)), postings_(std::move(postings)), ind_(0) {}
+
+    int64_t doc() const override {
+        return ind_ < docs_.size() ? docs_[ind_] : endOfList;
+    }
+
+    void advance(int64_t target) override {
+        if (doc() >= target) {
+            return;
+        }
+        ind_ = std::lower_bound(docs_.begin() + ind_, docs_.end(), target) - docs_.begin();
+    }
+
+    double score() const override {
+        return scores_[ind_];
+    }
+
+    void postings(std::vector<TermPosting>& out) const override {
+        if (ind_ < postings_.size()) {
+            out.insert(out.end(), postings_[ind_].begin(), postings_[ind_].end());
+        }
+    }
+
+private:
+    std::vector<int64_t> docs_;
+    std::vector<double> scores_;
+    std::vector<std::vector<TermPosting> > postings_;
+    size_t ind_;
+};
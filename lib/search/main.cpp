@@ -1,15 +1,108 @@
 #include "search.hpp"
+#include "shards.hpp"
 
 int main(int argc, char* argv[]) {
-    
+
     Search s;
+    ShardedSearch sharded;
+    bool print_stats = false;
+    bool shards = false;
+    int64_t reload_ms = -1;
 
-    if (argc == 2) {
+    if (argc >= 2) {
         s.chooseK(std::stoi(argv[1]));
+        sharded.chooseK(std::stoi(argv[1]));
+    }
+
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--context" && i + 1 < argc) {
+            s.chooseContext(std::stoll(argv[++i]));
+            sharded.chooseContext(std::stoll(argv[i]));
+        } else if (arg == "--max-expansions" && i + 1 < argc) {
+            s.chooseMaxExpansions(std::stoll(argv[++i]));
+            sharded.chooseMaxExpansions(std::stoll(argv[i]));
+        } else if (arg == "--io" && i + 1 < argc) {
+            std::string io = argv[++i];
+            IoBackend backend;
+            if (io == "uring") {
+                backend = IoBackend::URING;
+            } else if (io == "threads") {
+                backend = IoBackend::THREADS;
+            } else if (io == "sync") {
+                backend = IoBackend::SYNC;
+            } else {
+                std::cerr << "--unknown io backend: " << io << '\n';
+                std::exit(EXIT_FAILURE);
+            }
+            s.chooseIo(backend);
+            sharded.chooseIo(backend);
+        } else if (arg == "--eval" && i + 1 < argc) {
+            std::string eval = argv[++i];
+            Evaluation evaluation;
+            if (eval == "auto") {
+                evaluation = Evaluation::AUTO;
+            } else if (eval == "daat") {
+                evaluation = Evaluation::DOCUMENT_AT_A_TIME;
+            } else if (eval == "taat") {
+                evaluation = Evaluation::TERM_AT_A_TIME;
+            } else {
+                std::cerr << "--unknown evaluation: " << eval << '\n';
+                std::exit(EXIT_FAILURE);
+            }
+            s.chooseEvaluation(evaluation);
+            sharded.chooseEvaluation(evaluation);
+        } else if (arg == "--no-tier") {
+            s.useTier(false);
+            sharded.useTier(false);
+        } else if (arg == "--shards") {
+            shards = true;
+        } else if (arg == "--serve" && i + 1 < argc) {
+            reload_ms = std::stoll(argv[++i]);
+        } else if (arg == "--stats") {
+            print_stats = true;
+            s.collectStats(true);
+        } else {
+            std::cerr << "--unknown option: " << arg << '\n';
+            std::exit(EXIT_FAILURE);
+        }
     }
-        
+
     std::string input;
+
+    // One query per line until the end of the input, new generations of the index are picked up
+    // in the background every reload_ms milliseconds.
+    if (reload_ms >= 0) {
+        if (shards) {
+            std::cerr << "--serve does not search shards" << '\n';
+            std::exit(EXIT_FAILURE);
+        }
+        s.startReloader(std::chrono::milliseconds(std::max<int64_t>(1, reload_ms)));
+        while (std::getline(std::cin, input)) {
+            s.createParser(input);
+            std::cout << '\n';
+            if (print_stats) {
+                std::cerr << s.stats().toJson() << '\n';
+            }
+            std::cout.flush();
+        }
+        return 0;
+    }
+
     std::getline(std::cin, input);
 
+    if (shards) {
+        if (print_stats) {
+            std::cerr << "--stats are not collected across shards" << '\n';
+            std::exit(EXIT_FAILURE);
+        }
+        sharded.search(input);
+        return 0;
+    }
+
     s.createParser(input);
-}
\ No newline at end of file
+
+    if (print_stats) {
+        std::cerr << s.stats().toJson() << '\n';
+    }
+}
@@ -1,16 +1,30 @@
+#include "../index/analyzer.hpp"
+#include "../trie/errors.hpp"
 #include "../trie/trie.hpp"
 
 #include <string>
+#include <memory>
+#include <unordered_map>
 
 enum class TokenType {
     WORD,
+    WILDCARD,
+    FUZZY,
     AND,
     OR,
+    NOT,
     OPEN_PARENTHESIS,
     CLOSE_PARENTHESIS,
     END,
 };
 
+inline bool isLeaf(TokenType type) {
+    return type == TokenType::WORD || type == TokenType::WILDCARD || type == TokenType::FUZZY;
+}
+
+// The largest N of term~N.
+const int64_t maxFuzzyDistance = 2;
+
 struct Token {
     TokenType type;
     std::string value;
@@ -29,6 +43,7 @@ struct Node {
 
 struct ASTNode {
     double bm;
+    int64_t cursor_ind = -1;
     TokenType type;
     std::string value;
     std::shared_ptr<ASTNode> left;
@@ -41,7 +56,7 @@ struct ASTNode {
 
 class Lexer {
 public:
-    explicit Lexer(std::string input) : input(std::move(input)) {
+    explicit Lexer(std::string input, AnalyzerOptions options = {}) : input(std::move(input)), analyzer(options) {
         this->pos = 0;
     }
 
@@ -55,18 +70,32 @@ public:
                 return {TokenType::END, ""};
             }
 
-            if (std::isalpha(input[pos])) {
-                std::string value;
-                while (pos < input.length() && std::isalpha(input[pos])) {
-                    value += input[pos++];
+            if (wordLength(pos) > 0) {
+                size_t begin = pos;
+                for (size_t len; pos < input.length() && (len = wordLength(pos)) > 0;) {
+                    pos += len;
                 }
-                if (value == "AND") {
-                    return {TokenType::AND, value};
-                } else if (value == "OR") {
-                    return {TokenType::OR, value};
+                std::string_view word = std::string_view(input).substr(begin, pos - begin);
+                if (word == "AND") {
+                    return {TokenType::AND, std::string(word)};
+                } else if (word == "OR") {
+                    return {TokenType::OR, std::string(word)};
+                } else if (word == "NOT") {
+                    return {TokenType::NOT, std::string(word)};
                 } else {
-                    for (size_t i = 0; i < value.length(); ++i) {
-                        value[i] = std::tolower(value[i]);
+                    // Wildcard and fuzzy terms are only folded, stemming a part of a word would change what it matches.
+                    std::string value;
+                    if (pos < input.length() && input[pos] == '~') {
+                        Analyzer::fold(word, value);
+                        return fuzzyToken(value);
+                    }
+                    if (word.find('*') != std::string_view::npos) {
+                        Analyzer::fold(word, value);
+                        return {TokenType::WILDCARD, value};
+                    }
+                    // A stopword is kept, the search drops it from the query and reports it is not indexed.
+                    if (!analyzer.analyze(word, value)) {
+                        Analyzer::fold(word, value);
                     }
                     return {TokenType::WORD, value};
                 }
@@ -79,8 +108,7 @@ public:
                 case ')':
                     return {TokenType::CLOSE_PARENTHESIS, ")"};
                 default:
-                    std::cerr << "--invalid character encountered";
-                    std::exit(EXIT_FAILURE);
+                    fail("invalid character encountered");
             }
         }
 
@@ -90,6 +118,29 @@ public:
 private:
     std::string input;
     size_t pos = 0;
+    Analyzer analyzer;
+
+    size_t wordLength(size_t i) const {
+        return input[i] == '*' ? 1 : Analyzer::letterLength(input, i);
+    }
+
+    // term~N, the distance defaults to 2 when N is omitted. The value keeps the "~N" suffix. A larger
+    // distance would match most of the dictionary.
+    Token fuzzyToken(std::string value) {
+        if (value.find('*') != std::string::npos) {
+            fail("wildcards can not be fuzzy");
+        }
+        ++pos;
+        std::string distance;
+        while (pos < input.length() && std::isdigit(input[pos])) {
+            distance += input[pos++];
+        }
+        if (distance.size() > 1 || (!distance.empty() && distance[0] - '0' > maxFuzzyDistance)) {
+            fail("fuzzy distance is at most " + std::to_string(maxFuzzyDistance));
+        }
+
+        return {TokenType::FUZZY, value + '~' + (distance.empty() ? "2" : distance)};
+    }
 };
 
 class Parser {
@@ -109,8 +160,7 @@ public:
     std::shared_ptr<ASTNode> parse() {
         auto ast = expr();
         if (currentToken.type != TokenType::END) {
-            std::cerr << "--unexpected tokens after expression";
-            std::exit(EXIT_FAILURE);
+            fail("unexpected tokens after expression");
         }
         return ast;
     }
@@ -123,12 +173,82 @@ public:
         getTermsFromAST(node->left, all_terms);
         getTermsFromAST(node->right, all_terms);
 
-        if (node->type == TokenType::WORD) {
+        if (isLeaf(node->type)) {
             all_terms.push_back(node->value);
         }
 
     }
 
+    // The query with every operator parenthesized, queries written differently that parse the same
+    // ("a  AND b", "(A AND b)") get the same string.
+    static std::string toString(const std::shared_ptr<ASTNode>& node) {
+        if (node == nullptr) {
+            return "";
+        }
+        if (isLeaf(node->type)) {
+            return node->value;
+        }
+
+        return "(" + toString(node->left) + " " + node->value + " " + toString(node->right) + ")";
+    }
+
+    // Stopwords are not indexed, so their leaves are dropped from the query: an operator left with one
+    // side is replaced by it ("the AND cat" is "cat"), a NOT without its left side matches nothing.
+    // Null when nothing is left. The dropped stopwords are added to dropped.
+    static std::shared_ptr<ASTNode> dropStopwords(const std::shared_ptr<ASTNode>& node, const Analyzer& analyzer,
+                                                  std::vector<std::string>& dropped) {
+        if (node == nullptr) {
+            return nullptr;
+        }
+        if (isLeaf(node->type)) {
+            if (node->type == TokenType::WORD && analyzer.isStopword(node->value)) {
+                dropped.push_back(node->value);
+                return nullptr;
+            }
+            return node;
+        }
+
+        std::shared_ptr<ASTNode> left = dropStopwords(node->left, analyzer, dropped);
+        std::shared_ptr<ASTNode> right = dropStopwords(node->right, analyzer, dropped);
+        if (left == nullptr || right == nullptr) {
+            std::shared_ptr<ASTNode> kept = node->type == TokenType::NOT ? left : (left ? left : right);
+            if (kept != nullptr) {
+                kept->parent = node->parent;
+            }
+            return kept;
+        }
+        node->left = left;
+        node->right = right;
+        left->parent = node;
+        right->parent = node;
+
+        return node;
+    }
+
+    // Whether the documents of the node are excluded, i.e. it is on the right of a NOT.
+    static bool isNegated(std::shared_ptr<ASTNode> node) {
+        for (; node->parent != nullptr; node = node->parent) {
+            if (node->parent->type == TokenType::NOT && node->parent->right == node) {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    void getLeavesFromAST(std::shared_ptr<ASTNode> node, std::vector<std::shared_ptr<ASTNode> >& leaves) {
+        if (node == nullptr) {
+            return;
+        }
+
+        getLeavesFromAST(node->left, leaves);
+        getLeavesFromAST(node->right, leaves);
+
+        if (isLeaf(node->type)) {
+            leaves.push_back(node);
+        }
+    }
+
     void setZero(std::shared_ptr<ASTNode> node) {
         if (node == nullptr) {
             return;
@@ -137,7 +257,7 @@ public:
         setZero(node->left);
         setZero(node->right);
 
-        if (node->type == TokenType::WORD) {
+        if (isLeaf(node->type)) {
             node->bm = 0;
         }
     }
@@ -150,7 +270,7 @@ public:
         setScores(node->left, map);
         setScores(node->right, map);
 
-        if (node->type == TokenType::WORD) {
+        if (isLeaf(node->type)) {
             node->bm = map[node->value];
         }
     }
@@ -165,6 +285,8 @@ public:
 
         if (node->type == TokenType::AND) {
             node->bm = node->left->bm * node->right->bm;
+        } else if (node->type == TokenType::NOT) {
+            node->bm = node->left->bm;
         } else if (node->type == TokenType::OR) {
             node->bm = node->left->bm + node->right->bm;
         }
@@ -179,15 +301,14 @@ private:
         if (currentToken.type == type) {
             currentToken = lexer.getNextToken();
         } else {
-            std::cerr << "--unexpected token type";
-            std::exit(EXIT_FAILURE);
+            fail("unexpected token type");
         }
     }
 
     std::shared_ptr<ASTNode> factor() {
-        if (currentToken.type == TokenType::WORD) {
+        if (isLeaf(currentToken.type)) {
             auto node = std::make_shared<ASTNode>(currentToken.type, currentToken.value);
-            eat(TokenType::WORD);
+            eat(currentToken.type);
             return node;
         } else if (currentToken.type == TokenType::OPEN_PARENTHESIS) {
             eat(TokenType::OPEN_PARENTHESIS);
@@ -195,15 +316,19 @@ private:
             eat(TokenType::CLOSE_PARENTHESIS);
             return node;
         }
-        std::cerr << "--unexpected token in factor";
-        std::exit(EXIT_FAILURE);
+        fail("unexpected token in factor");
     }
 
+    // "a NOT b" and "a AND NOT b" both give a NOT node keeping the documents of a without b.
     std::shared_ptr<ASTNode> term() {
         auto node = factor();
-        while (currentToken.type == TokenType::AND) {
+        while (currentToken.type == TokenType::AND || currentToken.type == TokenType::NOT) {
             auto token = currentToken;
-            eat(TokenType::AND);
+            eat(token.type);
+            if (token.type == TokenType::AND && currentToken.type == TokenType::NOT) {
+                token = currentToken;
+                eat(TokenType::NOT);
+            }
             auto newNode = std::make_shared<ASTNode>(token.type, token.value);
             newNode->left = node;
             newNode->left->parent = newNode;
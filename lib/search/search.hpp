@@ -1,275 +1,910 @@
 #pragma once
 #include "parsing.hpp"
-
+#include "snippet.hpp"
+#include "stats.hpp"
+#include "cache.hpp"
+#include "cursor.hpp"
+#include "snapshot.hpp"
+#include "taat.hpp"
+#include "../index/generations.hpp"
+
+#include <map>
 #include <queue>
+#include <sstream>
 #include <functional>
 #include <cmath>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "algorithm"
 
-class Search {
-public:
-    Search() : trie(new Trie()), k_(1) {
-        std::fstream trie_tree;
-        trie_tree.open(trie_p, std::ios::binary | std::ios::in | std::ios::out);
+// Wildcard and fuzzy terms expanding to more terms are evaluated ahead into per-document scores instead of a heap union.
+const size_t unionHeapLimit = 16;
 
-        trie_tree.seekg(0);
+// How a query is scored: cursors moving over all its posting lists document by document, or the
+// posting lists one after the other into per-document scores, see taat.hpp. AUTO lets the planner pick.
+enum class Evaluation {
+    AUTO,
+    DOCUMENT_AT_A_TIME,
+    TERM_AT_A_TIME,
+};
 
-        trie_tree.read(reinterpret_cast<char*>(&doc_count), sizeof(int64_t));
-        scores_of_files.resize(doc_count, 0.0);
+// The planner scores a query ORing its terms term at a time when its posting lists hold at least one
+// posting per this many documents: the scores array costs a scan and a clear of its documents, the
+// cursors a heap step and an AST evaluation per posting.
+const int64_t termAtATimeDocsPerPosting = 16;
+
+// The warning of a query term missing from the index starts with this, followed by the term and an
+// optional ", did you mean" suggestion.
+const std::string unknownTermWarning = "term was not found in trie: ";
+
+class Search {
+public:
+    Search() : lexer(nullptr), parser(nullptr), k_(1), max_expansions_(1024), context_(0), snippets_(false), stats_enabled_(false) {}
 
-        trie_tree.read(reinterpret_cast<char*>(&dlavg), sizeof(int64_t));
-        trie = trie->saveBackToRAM(trie_tree);
-        trie_tree.close();
+    // Opens the published generation of the index, see IndexGenerations.
+    void open() {
+        snapshots_->open();
     }
-    
+
     ~Search() {
-        delete trie;
+        stopReloader();
         delete lexer;
+        delete parser;
+    }
+
+    // Without a reloader every query first checks which generation is published and opens a new
+    // one itself. With it, a background thread checks every interval, opens a new generation with
+    // its dictionary and swaps it in: queries started before keep the generation they started on,
+    // the next ones take the new one, and the old one is freed when the last of them is done.
+    void startReloader(std::chrono::milliseconds interval) {
+        stopReloader();
+        if (snapshots_->current() == nullptr) {
+            open();
+        }
+        reloader_stop_ = false;
+        reloader_ = std::thread([this, interval] {
+            std::unique_lock<std::mutex> lock(reloader_mutex_);
+            while (!reloader_wake_.wait_for(lock, interval, [this] { return reloader_stop_; })) {
+                lock.unlock();
+                reload();
+                lock.lock();
+            }
+        });
+    }
+
+    void stopReloader() {
+        if (!reloader_.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(reloader_mutex_);
+            reloader_stop_ = true;
+        }
+        reloader_wake_.notify_one();
+        reloader_.join();
+    }
+
+    // Swaps in the published generation when it is not the one served, true when it did.
+    bool reload() {
+        if (!snapshots_->reload()) {
+            return false;
+        }
+        ++reloads_;
+
+        return true;
+    }
+
+    // Generation of the index the next query runs on.
+    int64_t generation() {
+        return acquire()->generation;
+    }
+
+    int64_t reloads() const {
+        return reloads_;
     }
 
     void chooseK(int kaka) {
         k_ = kaka;
     }
 
+    void chooseMaxExpansions(int64_t max_expansions) {
+        max_expansions_ = max_expansions;
+    }
+
+    void chooseContext(int64_t context) {
+        context_ = context;
+        snippets_ = true;
+    }
+
+    void chooseEvaluation(Evaluation evaluation) {
+        evaluation_ = evaluation;
+    }
+
+    // With false the first tier of the index, when it has one, is not read.
+    void useTier(bool enabled) {
+        use_tier_ = enabled;
+    }
+
+    void chooseIo(IoBackend backend) {
+        io_backend_ = backend;
+        reader_.reset();
+    }
+
+    // Scores are computed with this average document length instead of the index's own, so that the
+    // scores of the shards of one collection are comparable.
+    void useGlobalAverageLength(int64_t dlavg) {
+        global_dlavg_ = dlavg;
+    }
+
+    // With false the results are only kept for results(), nothing is printed.
+    void printResults(bool enabled) {
+        print_results_ = enabled;
+    }
+
+    // With false the warnings of a query (unknown terms, expansion limits) are only kept for warnings().
+    void printWarnings(bool enabled) {
+        print_warnings_ = enabled;
+    }
+
+    const std::vector<SearchResult>& results() const {
+        return results_;
+    }
+
+    const std::vector<std::string>& warnings() const {
+        return warnings_;
+    }
+
+    // Reads the index published under root instead of the directory of the index file globals.
+    void setIndexRoot(const std::string& root) {
+        std::shared_ptr<IndexSnapshots> snapshots = std::make_shared<IndexSnapshots>(root);
+        snapshots->setResultCacheSize(snapshots_->resultCacheSize());
+        snapshots->setBlockCacheSize(snapshots_->blockCacheSize());
+        snapshots_ = snapshots;
+    }
+
+    // Queries run on the generations of snapshots, shared with the other Searches given it: one
+    // dictionary and one pair of caches for all of them.
+    void shareSnapshots(std::shared_ptr<IndexSnapshots> snapshots) {
+        snapshots_ = std::move(snapshots);
+    }
+
+    const std::shared_ptr<IndexSnapshots>& snapshots() const {
+        return snapshots_;
+    }
+
+    // Capacities in bytes of the cache of displayed results by query and of the cache of posting
+    // blocks, 0 disables a cache. Both belong to the opened generation and go with it.
+    void setResultCacheSize(int64_t bytes) {
+        snapshots_->setResultCacheSize(bytes);
+    }
+
+    void setBlockCacheSize(int64_t bytes) {
+        snapshots_->setBlockCacheSize(bytes);
+    }
+
+    const ResultCache& resultCache() {
+        return acquire()->results;
+    }
+
+    const BlockCache& blockCache() {
+        return acquire()->blocks;
+    }
+
+    void collectStats(bool enabled) {
+        stats_enabled_ = enabled;
+    }
+
+    const QueryStats& stats() const {
+        return stats_;
+    }
+
     void createParser(std::string& input) {
-        lexer = new Lexer(input);
+        index_ = acquire();
+        scores_of_files.resize(index_->doc_count, 0.0f);
+
+        delete lexer;
+        delete parser;
+        lexer = nullptr;
+        parser = nullptr;
+        pr = {};
+        shown_.clear();
+        stats_ = QueryStats();
+        warnings_.clear();
+        PhaseClock clock(stats_enabled_);
+        int64_t syscalls_before = stats_enabled_ ? readSyscallsSoFar() : 0;
+
+        lexer = new Lexer(input, index_->analyzer);
         parser = new Parser(*lexer);
 
         std::shared_ptr<ASTNode> ast;
         try {
             ast = (*parser).parse();
+        } catch (const EngineError&) {
+            throw;
         } catch (const std::exception& e) {
-            std::cerr << "--error: " << e.what() << '\n';
+            fail(std::string("error: ") + e.what());
         }
 
-        std::vector<std::string> all_terms;
-        parser->getTermsFromAST(ast, all_terms);
+        // A hit gives the warnings of the query as well as its results.
+        std::string cache_key = resultCacheKey(ast);
+        if (auto cached = index_->results.get(cache_key)) {
+            clock.lap(stats_.parse_ms);
+            stats_.result_cache_hit = true;
+            for (const std::string& warning : cached->warnings) {
+                warn(warning);
+            }
+            results_ = cached->results;
+            if (print_results_) {
+                if (results_.empty()) {
+                    std::cout << "--sorry, nothing was found";
+                }
+                for (const SearchResult& result : results_) {
+                    std::cout << result.text;
+                }
+            }
+            clock.lap(stats_.render_ms);
+            if (stats_enabled_) {
+                stats_.read_syscalls = readSyscallsSoFar() - syscalls_before;
+            }
+            index_.reset();
+            return;
+        }
 
-        std::vector<std::pair<int64_t, std::string> > iterators;
-        std::unordered_map<std::string, int64_t> iterators_indexes;
-        for (auto it : all_terms) {
-            iterators.push_back({doc_count + 1, it});
+        std::vector<std::string> stopwords;
+        ast = Parser::dropStopwords(ast, Analyzer(index_->analyzer), stopwords);
+        for (const std::string& stopword : stopwords) {
+            warn(stopword + " is a stopword, stopwords are not indexed");
         }
 
-        std::fstream posting_lists;
-        posting_lists.open(posting_lists_p, std::ios::binary | std::ios::in | std::ios::out);
+        std::vector<std::shared_ptr<ASTNode> > leaves;
+        parser->getLeavesFromAST(ast, leaves);
+        clock.lap(stats_.parse_ms);
 
-        for (int64_t i = 0; i < all_terms.size(); ++i) {
-            int64_t posting_list_pos = trie->find(all_terms[i]);
-            if (posting_list_pos == -1) {
-                std::cerr << "--term was not found in trie: " << all_terms[i] << '\n';
-                std::exit(EXIT_FAILURE);
+        if (ast == nullptr) {
+            results_.clear();
+            if (print_results_) {
+                std::cout << "--sorry, nothing was found";
             }
+            index_.reset();
+            return;
+        }
 
-            posting_lists.seekg(posting_list_pos);
-            int64_t df;
-            posting_lists.read(reinterpret_cast<char*>(&df), sizeof(int64_t));
+        if (reader_ == nullptr) {
+            reader_ = AsyncReader::create(io_backend_);
+        }
+        reader_->reset();
+        int64_t submitted_before = reader_->submitted();
+        int posting_lists = ::open(index_->posting_lists.c_str(), O_RDONLY);
+        posix_fadvise(posting_lists, 0, 0, POSIX_FADV_RANDOM);
+        ++stats_.files_opened;
 
-            if (df > 0) {
-                posting_lists.read(reinterpret_cast<char*>(&iterators[i].first), sizeof(int64_t));
+        std::vector<std::string> all_terms;
+        std::vector<std::vector<TermMatch> > leaf_terms(leaves.size());
+        // The index of every term of a leaf in all_terms, -1 for the terms of an excluded leaf.
+        std::vector<std::vector<int64_t> > term_ids(leaves.size());
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            auto& leaf = leaves[i];
+            std::vector<TermMatch>& terms = leaf_terms[i];
+            if (leaf->type == TokenType::WILDCARD) {
+                wildcard(leaf->value, terms);
+            } else if (leaf->type == TokenType::FUZZY) {
+                fuzzy(leaf->value, terms);
+            } else {
+                int64_t posting_list_pos = lookup(leaf->value);
+                if (posting_list_pos == -1) {
+                    suggest(leaf->value);
+                } else {
+                    terms.push_back({leaf->value, posting_list_pos, 0});
+                }
+            }
+
+            bool negated = Parser::isNegated(leaf);
+            for (auto& term : terms) {
+                term_ids[i].push_back(negated ? -1 : static_cast<int64_t>(all_terms.size()));
+                if (!negated) {
+                    all_terms.push_back(term.term);
+                }
             }
         }
-        posting_lists.close();
 
-        posting_lists.open(posting_lists_p, std::ios::binary | std::ios::in | std::ios::out);
+        if (use_tier_ && evaluateTier(ast, leaves, leaf_terms, term_ids)) {
+            stats_.evaluation = "tier";
+            clock.lap(stats_.plan_ms);
+        } else {
+            // All the first blocks are queued before any is waited for, so they are read concurrently.
+            std::vector<std::vector<std::unique_ptr<TermCursor> > > leaf_cursors(leaves.size());
+            for (size_t i = 0; i < leaves.size(); ++i) {
+                for (size_t j = 0; j < leaf_terms[i].size(); ++j) {
+                    const TermMatch& term = leaf_terms[i][j];
+                    leaf_cursors[i].emplace_back(new TermCursor(*reader_, posting_lists, term.posting_list_pos, dlavg(), stats_,
+                                                                fuzzyWeight(term.distance), &index_->blocks, term_ids[i][j]));
+                }
+            }
+            reader_->flush();
+
+            if (plansTermAtATime(ast, leaf_cursors)) {
+                stats_.evaluation = "taat";
+                clock.lap(stats_.plan_ms);
+                accumulate(leaf_cursors);
+            } else {
+                stats_.evaluation = "daat";
+                evaluateDocuments(ast, leaves, leaf_terms, leaf_cursors, clock);
+            }
+        }
+        cursors.clear();
+        bitmaps.clear();
+        ::close(posting_lists);
+        stats_.async_reads = reader_->submitted() - submitted_before;
+        stats_.io_backend = reader_->name();
+        clock.lap(stats_.evaluate_ms);
 
-        bool flag = false;
-        while (true) {
-            std::sort(iterators.begin(), iterators.end());
-            std::unordered_map<std::string, double> map;
+        DisplayAnswer(all_terms);
+        if (index_->results.capacity() > 0) {
+            int64_t bytes = sizeof(CachedQuery) + cache_key.size();
+            for (const std::string& warning : warnings_) {
+                bytes += sizeof(std::string) + warning.size();
+            }
+            for (const SearchResult& result : results_) {
+                bytes += sizeof(SearchResult) + result.text.size() + result.path.size() + result.lines.size() * sizeof(int64_t);
+                for (const std::string& duplicate : result.duplicates) {
+                    bytes += sizeof(std::string) + duplicate.size();
+                }
+            }
+            index_->results.put(cache_key, std::make_shared<CachedQuery>(CachedQuery{results_, warnings_}), bytes);
+        }
+        clock.lap(stats_.render_ms);
+
+        if (stats_enabled_) {
+            stats_.read_syscalls = readSyscallsSoFar() - syscalls_before;
+        }
+        index_.reset();
+    }
+
+private:
 
-            int64_t index = 0;
-            for (; index < iterators.size(); ++index) {
-                if (index > 0 && iterators[index - 1].first != iterators[index].first) {
-                    break;
+    // The generations new queries start on, and the one the running query holds.
+    std::shared_ptr<IndexSnapshots> snapshots_ = std::make_shared<IndexSnapshots>();
+    std::shared_ptr<IndexSnapshot> index_;
+    std::thread reloader_;
+    std::mutex reloader_mutex_;
+    std::condition_variable reloader_wake_;
+    bool reloader_stop_ = false;
+    std::atomic<int64_t> reloads_{0};
+    Lexer* lexer;
+    Parser* parser;
+    int64_t k_;
+    int64_t max_expansions_;
+    int64_t context_;
+    bool snippets_;
+    bool stats_enabled_;
+    QueryStats stats_;
+
+    std::vector<float> scores_of_files;
+    std::priority_queue<std::pair<int64_t, double> > pr;
+    std::vector<std::unique_ptr<Cursor> > cursors;
+    std::vector<std::unique_ptr<Roaring> > bitmaps;
+    IoBackend io_backend_ = IoBackend::AUTO;
+    Evaluation evaluation_ = Evaluation::AUTO;
+    bool use_tier_ = true;
+    int64_t global_dlavg_ = 0;
+    bool print_results_ = true;
+    bool print_warnings_ = true;
+    std::vector<std::string> warnings_;
+    std::vector<SearchResult> results_;
+    std::unique_ptr<AsyncReader> reader_;
+    // The postings of the displayed terms on the highest matches found so far, at most k of them: the
+    // results are the highest documents, and their lines are printed from these.
+    std::map<int64_t, std::vector<TermPosting> > shown_;
+
+    // The generation a query runs on; without a reloader the published one is opened first when it changed.
+    std::shared_ptr<IndexSnapshot> acquire() {
+        return snapshots_->acquire(!reloader_.joinable());
+    }
+
+    // Cursors over the leaves, moved together document by document through nextMatch.
+    void evaluateDocuments(const std::shared_ptr<ASTNode>& ast, std::vector<std::shared_ptr<ASTNode> >& leaves,
+                           std::vector<std::vector<TermMatch> >& leaf_terms,
+                           std::vector<std::vector<std::unique_ptr<TermCursor> > >& leaf_cursors, PhaseClock& clock) {
+        std::fstream bitmap_file;
+        cursors.clear();
+        bitmaps.clear();
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            auto& leaf = leaves[i];
+            leaf->cursor_ind = cursors.size();
+            if (leaf->type == TokenType::WORD && leaf_cursors[i].size() == 1) {
+                TermCursor* cursor = leaf_cursors[i][0].release();
+                cursor->open();
+                cursors.emplace_back(cursor);
+                bitmaps.push_back(loadBitmap(bitmap_file, leaf_terms[i][0].posting_list_pos, cursor->df()));
+                cursor->useBitmap(bitmaps.back().get());
+            } else {
+                cursors.push_back(unionOf(leaf_cursors[i]));
+                bitmaps.emplace_back(nullptr);
+            }
+        }
+        clock.lap(stats_.plan_ms);
+        scoreMatches(ast, leaves, 0);
+    }
+
+    // Scores the matches of the query from the document floor on into the results heap, returns their count.
+    int64_t scoreMatches(const std::shared_ptr<ASTNode>& ast, std::vector<std::shared_ptr<ASTNode> >& leaves, int64_t floor) {
+
+        Roaring filter;
+        bool exact;
+        bool filtered = candidates(ast, filter, exact);
+        std::vector<int64_t> candidate_docs;
+        if (filtered) {
+            candidate_docs = filter.toVector();
+            stats_.candidates = candidate_docs.size();
+        }
+        size_t candidate = 0;
+        auto next = [&](int64_t target) {
+            if (filtered) {
+                candidate = std::lower_bound(candidate_docs.begin() + candidate, candidate_docs.end(), target) - candidate_docs.begin();
+                if (candidate == candidate_docs.size()) {
+                    return endOfList;
                 }
-                double score = findScore(iterators[index].first, iterators[index].second);
-                map.insert({iterators[index].second, score});
+                target = candidate_docs[candidate];
+            }
+
+            return nextMatch(ast, target);
+        };
 
-                ++iterators_indexes[iterators[index].second];
-                parser->setInd(iterators[index].first);
+        int64_t rez_count = 0;
+        for (int64_t doc = next(floor); doc != endOfList; doc = next(doc + 1)) {
+            std::unordered_map<std::string, double> map;
+            for (auto& leaf : leaves) {
+                Cursor& cursor = *cursors[leaf->cursor_ind];
+                if (cursor.doc() == doc) {
+                    map[leaf->value] = cursor.score();
+                }
             }
+
             parser->setZero(ast);
             parser->setScores(ast, map);
             parser->setORanD(ast);
+            ++stats_.documents_scored;
             double rez = ast->bm;
             if (rez > 0) {
-                pr.push({parser->getInd(), rez});
+                pr.push({doc, rez});
+                ++stats_.heap_insertions;
+                ++rez_count;
+                std::vector<TermPosting> postings;
+                for (auto& leaf : leaves) {
+                    Cursor& cursor = *cursors[leaf->cursor_ind];
+                    if (cursor.doc() == doc) {
+                        cursor.postings(postings);
+                    }
+                }
+                show(doc, std::move(postings));
             }
+        }
 
-            int64_t cur_posting_list_pos;
-
-            for (auto& it : iterators) {
-
-                cur_posting_list_pos = trie->find(it.second);
-                posting_lists.seekg(cur_posting_list_pos);
-
-                int64_t df;
-                posting_lists.read(reinterpret_cast<char*>(&df), sizeof(int64_t));
-                cur_posting_list_pos = posting_lists.tellg();
-
-                if (it.first != doc_count + 1) {
-                    if (iterators_indexes[it.second] >= df) {
-                        flag = true;
+        return rez_count;
+    }
 
-                        break;
+    // The first tier answers the query when it surely holds the k results. From the highest floor of the
+    // query terms on, every term has all its postings in the tier, so the matches there and their scores
+    // are the ones of the full lists, and the results are the highest matching documents. With fewer
+    // than k matches there lower documents may rank in, and the full lists are read instead.
+    bool evaluateTier(const std::shared_ptr<ASTNode>& ast, std::vector<std::shared_ptr<ASTNode> >& leaves,
+                      std::vector<std::vector<TermMatch> >& leaf_terms, const std::vector<std::vector<int64_t> >& term_ids) {
+        if (index_->tier.empty() || ast == nullptr) {
+            return false;
+        }
+        cursors.clear();
+        bitmaps.clear();
+        int64_t floor = 0;
+        for (size_t i = 0; i < leaves.size(); ++i) {
+            std::vector<std::unique_ptr<Cursor> > parts;
+            for (size_t t = 0; t < leaf_terms[i].size(); ++t) {
+                const TermMatch& term = leaf_terms[i][t];
+                TierList list;
+                if (!index_->tier.find(term.posting_list_pos, list)) {
+                    cursors.clear();
+                    return false;
+                }
+                floor = std::max(floor, list.floor());
+                std::vector<int64_t> docs(list.count);
+                std::vector<double> scores(list.count);
+                std::vector<std::vector<TermPosting> > postings(term_ids[i][t] >= 0 ? list.count : 0);
+                for (int64_t j = 0; j < list.count; ++j) {
+                    const DID& dId = list.dids[j];
+                    docs[j] = dId.ind;
+                    scores[j] = fuzzyWeight(term.distance) * BM25(dId.tf, dlavg(), dId.dl);
+                    if (!postings.empty()) {
+                        postings[j].push_back({term_ids[i][t], dId.pos_of_nums_lines});
                     }
-                    posting_lists.seekg(cur_posting_list_pos + (iterators_indexes[it.second]) * 5 * sizeof(int64_t));
-                    posting_lists.read(reinterpret_cast<char*>(&it.first), sizeof(int64_t));
                 }
+                stats_.postings_decoded += list.count;
+                parts.emplace_back(new ListCursor(std::move(docs), std::move(scores), std::move(postings)));
             }
-            if (flag) { 
-                break; 
+            leaves[i]->cursor_ind = cursors.size();
+            if (parts.size() == 1) {
+                cursors.push_back(std::move(parts[0]));
+            } else {
+                cursors.emplace_back(new UnionCursor(std::move(parts)));
             }
+            bitmaps.emplace_back(nullptr);
         }
-        posting_lists.close();
-        double rez = ast->bm;
-        
-        DisplayAnswer(all_terms);
-    }
 
-private:
+        if (scoreMatches(ast, leaves, floor) >= k_) {
+            return true;
+        }
+        pr = {};
+        shown_.clear();
+        cursors.clear();
+        bitmaps.clear();
+        stats_.tier_fallback = true;
 
-    Trie* trie;
-    int64_t dlavg;
-    int64_t doc_count;
-    Lexer* lexer;
-    Parser* parser;
-    int64_t k_;
+        return false;
+    }
 
-    std::vector<double> scores_of_files;
-    std::priority_queue<std::pair<int64_t, double> > pr;
+    int64_t dlavg() const {
+        return global_dlavg_ ? global_dlavg_ : index_->dlavg;
+    }
 
-    void DisplayAnswer(std::vector<std::string>& all_terms) {
-        if (pr.size() == 0) {
-            std::cout << "--sorry, nothing was found";
+    static bool orOfTerms(const std::shared_ptr<ASTNode>& node) {
+        if (node == nullptr) {
+            return false;
+        }
+        if (node->type == TokenType::OR) {
+            return orOfTerms(node->left) && orOfTerms(node->right);
+        }
 
-            return;
+        return isLeaf(node->type);
+    }
+
+    // Only a query ORing its terms can be scored term at a time: its score is the sum of the scores of
+    // its postings. The posting counts are known once the first blocks are in.
+    bool plansTermAtATime(const std::shared_ptr<ASTNode>& ast, std::vector<std::vector<std::unique_ptr<TermCursor> > >& leaf_cursors) {
+        if (evaluation_ == Evaluation::DOCUMENT_AT_A_TIME || !orOfTerms(ast)) {
+            return false;
+        }
+        if (evaluation_ == Evaluation::TERM_AT_A_TIME) {
+            return true;
+        }
+        int64_t postings = 0;
+        for (auto& terms : leaf_cursors) {
+            for (auto& cursor : terms) {
+                cursor->open();
+                postings += cursor->df();
+            }
         }
 
-        std::fstream posting_lists;
-        posting_lists.open(posting_lists_p, std::ios::binary | std::ios::in | std::ios::out);
+        return postings * termAtATimeDocsPerPosting >= index_->doc_count;
+    }
 
-        std::fstream files_paths;
-        files_paths.open(files_paths_p, std::ios::binary | std::ios::in | std::ios::out);
+    // Every posting list is added into scores_of_files, which is left cleared for the next query. The
+    // results are the k highest documents, so a result is among the last k postings of every list it is
+    // in: only those are kept for the display.
+    void accumulate(std::vector<std::vector<std::unique_ptr<TermCursor> > >& leaf_cursors) {
+        float* scores = scores_of_files.data();
+        std::vector<std::pair<int64_t, std::vector<DID> > > tails;
+        for (auto& terms : leaf_cursors) {
+            for (auto& cursor : terms) {
+                std::vector<DID> tail;
+                cursor->forEachBlock([&](const DID* postings, int64_t count) {
+                    accumulateBM25(postings, count, cursor->weight(), cursor->dlavg(), scores);
+                    stats_.documents_scored += count;
+                    tail.insert(tail.end(), postings + std::max<int64_t>(0, count - k_), postings + count);
+                    if (static_cast<int64_t>(tail.size()) > k_) {
+                        tail.erase(tail.begin(), tail.end() - k_);
+                    }
+                });
+                if (cursor->term() >= 0) {
+                    tails.push_back({cursor->term(), std::move(tail)});
+                }
+                cursor.reset();
+            }
+        }
+        for (const auto& [doc, score] : topDocuments(scores, index_->doc_count, k_)) {
+            pr.push({doc, score});
+            ++stats_.heap_insertions;
+            std::vector<TermPosting> postings;
+            for (const auto& [term, tail] : tails) {
+                auto it = std::lower_bound(tail.begin(), tail.end(), doc, [](const DID& dId, int64_t doc) {
+                    return dId.ind < doc;
+                });
+                if (it != tail.end() && it->ind == doc) {
+                    postings.push_back({term, it->pos_of_nums_lines});
+                }
+            }
+            show(doc, std::move(postings));
+        }
+        std::fill(scores_of_files.begin(), scores_of_files.end(), 0.0f);
+    }
 
-        std::fstream line_nums;
-        line_nums.open(line_nums_p, std::ios::binary | std::ios::in | std::ios::out);
+    std::unique_ptr<Roaring> loadBitmap(std::fstream& posting_lists, int64_t posting_list_pos, int64_t df) {
+        if (!denseTerm(df, index_->doc_count)) {
+            return nullptr;
+        }
+        if (!posting_lists.is_open()) {
+            posting_lists.open(index_->posting_lists, std::ios::binary | std::ios::in);
+            ++stats_.files_opened;
+        }
+        posting_lists.seekg(posting_list_pos + sizeof(int64_t) + df * sizeof(DID));
+        std::unique_ptr<Roaring> bitmap(new Roaring());
+        stats_.bytes_read[POSTINGS] += bitmap->read(posting_lists);
+        ++stats_.bitmaps_read;
 
-        while (pr.size() != 0 && k_ > 0) {
-            int64_t cur_posting_list_pos;
+        return bitmap;
+    }
 
-            for (std::string& term : all_terms) {
-                cur_posting_list_pos = trie->find(term);
+    // Documents that may match the subtree according to the bitmaps of its dense terms, a superset
+    // of its matches, exact when every leaf below has a bitmap. Returns false when the subtree has
+    // no bitmap to narrow it down.
+    bool candidates(const std::shared_ptr<ASTNode>& node, Roaring& rez, bool& exact) {
+        if (node->type == TokenType::AND || node->type == TokenType::OR || node->type == TokenType::NOT) {
+            Roaring left;
+            Roaring right;
+            bool left_exact;
+            bool right_exact;
+            bool has_left = candidates(node->left, left, left_exact);
+            bool has_right = candidates(node->right, right, right_exact);
+            exact = false;
+
+            if (node->type == TokenType::NOT) {
+                // Only documents surely matching the excluded side can be removed.
+                if (has_left && has_right && right_exact) {
+                    rez = Roaring::AndNot(left, right);
+                    exact = left_exact;
+                } else if (has_left) {
+                    rez = std::move(left);
+                }
+                return has_left;
+            }
+            if (has_left && has_right) {
+                rez = node->type == TokenType::AND ? Roaring::And(left, right) : Roaring::Or(left, right);
+                exact = left_exact && right_exact;
+                return true;
+            }
+            if (node->type == TokenType::OR) {
+                return false;
+            }
+            rez = has_left ? std::move(left) : std::move(right);
 
-                posting_lists.seekg(cur_posting_list_pos);
-                int64_t df;
-                posting_lists.read(reinterpret_cast<char*>(&df), sizeof(int64_t));
+            return has_left || has_right;
+        }
 
-                for (int64_t i = 0; i < df; ++i) {
-                    posting_lists.seekp(cur_posting_list_pos + sizeof(int64_t) + i * 5 * sizeof(int64_t));
-                    int64_t file_ind;
-                    posting_lists.read(reinterpret_cast<char*>(&file_ind), sizeof(int64_t));
+        exact = true;
+        if (bitmaps[node->cursor_ind] == nullptr) {
+            return false;
+        }
+        rez = *bitmaps[node->cursor_ind];
 
-                    if (file_ind == pr.top().first) {
-                        std::cout << "TERM: '" << term << "'\n     ";
-                        int64_t name_pos;
-                        posting_lists.read(reinterpret_cast<char*>(&name_pos), sizeof(int64_t));
-                        
-                        files_paths.seekg(name_pos);
+        return true;
+    }
 
-                        int64_t file_path_len;
-                        files_paths.read(reinterpret_cast<char*>(&file_path_len), sizeof(int64_t));
+    // First document >= target matching the subtree, leaf cursors are left on the documents they stopped at.
+    int64_t nextMatch(const std::shared_ptr<ASTNode>& node, int64_t target) {
+        if (node->type == TokenType::AND) {
+            int64_t doc = target;
+            while (true) {
+                int64_t left = nextMatch(node->left, doc);
+                if (left == endOfList) {
+                    return endOfList;
+                }
+                int64_t right = nextMatch(node->right, left);
+                if (right == left || right == endOfList) {
+                    return right;
+                }
+                doc = right;
+            }
+        }
+        if (node->type == TokenType::OR) {
+            return std::min(nextMatch(node->left, target), nextMatch(node->right, target));
+        }
+        if (node->type == TokenType::NOT) {
+            // The excluded side is only advanced to the candidates of the left one, skipping the rest of it.
+            int64_t doc = target;
+            while (true) {
+                int64_t left = nextMatch(node->left, doc);
+                if (left == endOfList || nextMatch(node->right, left) != left) {
+                    return left;
+                }
+                doc = left + 1;
+            }
+        }
 
-                        char* buffer = new char[file_path_len + 1];
-                        buffer[file_path_len] = '\0';
-                        files_paths.read(buffer, file_path_len);
+        Cursor& cursor = *cursors[node->cursor_ind];
+        cursor.advance(target);
 
-                        std::cout << "name of file " << buffer << "   nums of lines: ";
+        return cursor.doc();
+    }
 
-                        cur_posting_list_pos = posting_lists.tellg();
-                        posting_lists.seekg(cur_posting_list_pos + 2 * sizeof(int64_t));
+    void wildcard(const std::string& pattern, std::vector<TermMatch>& terms) {
+        index_->dictionary().match(pattern, max_expansions_ + 1, terms);
+        ++stats_.dictionary_lookups;
+        if (static_cast<int64_t>(terms.size()) > max_expansions_) {
+            warn(pattern + " matches more than " + std::to_string(max_expansions_) + " terms, the rest are ignored");
+            terms.resize(max_expansions_);
+        }
+    }
 
-                        int64_t line_nums_pos;
-                        posting_lists.read(reinterpret_cast<char*>(&line_nums_pos), sizeof(int64_t));
+    // term~N: the closest terms are kept when there are more than max_expansions_ of them.
+    void fuzzy(const std::string& value, std::vector<TermMatch>& terms) {
+        size_t tilde = value.find('~');
+        index_->dictionary().fuzzy(value.substr(0, tilde), std::stoll(value.substr(tilde + 1)), terms);
+        ++stats_.dictionary_lookups;
+        std::stable_sort(terms.begin(), terms.end(), [](const TermMatch& a, const TermMatch& b) {
+            return a.distance < b.distance;
+        });
+        if (static_cast<int64_t>(terms.size()) > max_expansions_) {
+            terms.resize(max_expansions_);
+        }
+    }
 
-                        line_nums.seekg(line_nums_pos);
+    // An unknown term matches nothing, the closest indexed term is offered instead.
+    void suggest(const std::string& term) {
+        std::vector<TermMatch> close;
+        index_->dictionary().fuzzy(term, 2, close);
+        ++stats_.dictionary_lookups;
+        std::string message = unknownTermWarning + term;
+        if (!close.empty()) {
+            auto best = std::min_element(close.begin(), close.end(), [](const TermMatch& a, const TermMatch& b) {
+                return a.distance < b.distance;
+            });
+            message += ", did you mean " + best->term + '~' + std::to_string(best->distance) + '?';
+        }
+        warn(message);
+    }
 
-                        int64_t line_nums_count;
-                        line_nums.read(reinterpret_cast<char*>(&line_nums_count), sizeof(int64_t));
+    void warn(const std::string& message) {
+        warnings_.push_back(message);
+        if (print_warnings_) {
+            std::cerr << "--" << message << '\n';
+        }
+    }
 
-                        int64_t line;
-                        for (int64_t j = 0; j < line_nums_count; ++j) {
-                            line_nums.read(reinterpret_cast<char*>(&line), sizeof(int64_t));
-                            std::cout << line << " ";
-                        }
+    // Cursor over the union of the expansions of a term, an expansion at edit distance d is weighted by 1 / (1 + d).
+    // A few terms are merged through a heap, wider expansions are accumulated one posting list at a time
+    // into per-document scores.
+    std::unique_ptr<Cursor> unionOf(std::vector<std::unique_ptr<TermCursor> >& terms) {
+        for (auto& cursor : terms) {
+            cursor->open();
+        }
+        if (terms.size() <= unionHeapLimit) {
+            std::vector<std::unique_ptr<Cursor> > union_cursors;
+            for (auto& cursor : terms) {
+                union_cursors.push_back(std::move(cursor));
+            }
 
-                        std::cout << '\n';
+            return std::unique_ptr<Cursor>(new UnionCursor(std::move(union_cursors)));
+        }
 
-                        break;
-                    }
+        std::vector<double> scores(index_->doc_count, 0.0);
+        std::vector<bool> seen(index_->doc_count, false);
+        std::vector<std::vector<TermPosting> > postings(index_->doc_count);
+        std::vector<int64_t> docs;
+        for (auto& cursor : terms) {
+            for (; cursor->doc() != endOfList; cursor->next()) {
+                if (!seen[cursor->doc()]) {
+                    seen[cursor->doc()] = true;
+                    docs.push_back(cursor->doc());
                 }
+                scores[cursor->doc()] += cursor->score();
+                cursor->postings(postings[cursor->doc()]);
             }
-            pr.pop();
-            --k_;
+            cursor.reset();
+        }
+        std::sort(docs.begin(), docs.end());
+
+        std::vector<double> doc_scores;
+        std::vector<std::vector<TermPosting> > doc_postings;
+        doc_scores.reserve(docs.size());
+        doc_postings.reserve(docs.size());
+        for (int64_t doc : docs) {
+            doc_scores.push_back(scores[doc]);
+            doc_postings.push_back(std::move(postings[doc]));
         }
 
-        posting_lists.close();
-        files_paths.close();
-        line_nums.close();
+        return std::unique_ptr<Cursor>(new ListCursor(std::move(docs), std::move(doc_scores), std::move(doc_postings)));
     }
 
-    double findScore(int64_t id, std::string& term) {
-        std::fstream posting_lists;
-        posting_lists.open(posting_lists_p, std::ios::binary | std::ios::in | std::ios::out);
-
-        int64_t posting_list_pos = trie->find(term);
-        posting_lists.seekg(posting_list_pos);
+    // Everything the displayed results depend on besides the index.
+    std::string resultCacheKey(const std::shared_ptr<ASTNode>& ast) const {
+        return Parser::toString(ast) + '\n' + std::to_string(k_) + ' ' + std::to_string(max_expansions_) + ' ' +
+               std::to_string(snippets_ ? context_ : -1) + ' ' + std::to_string(global_dlavg_);
+    }
 
-        int64_t df;
-        int64_t cur_posting_list_pos;
-        posting_lists.read(reinterpret_cast<char*>(&df), sizeof(int64_t));
-        for (int64_t i = 0; i < df; ++i) {
-            int64_t ind;
-            posting_lists.read(reinterpret_cast<char*>(&ind), sizeof(int64_t));
+    static double fuzzyWeight(int64_t distance) {
+        return 1.0 / (1 + distance);
+    }
 
-            if (ind != id) {
-                cur_posting_list_pos = posting_lists.tellg();
-                posting_lists.seekg(cur_posting_list_pos + 4 * sizeof(int64_t));
-                continue;
+    void DisplayAnswer(std::vector<std::string>& all_terms) {
+        results_.clear();
+        if (pr.size() == 0) {
+            if (print_results_) {
+                std::cout << "--sorry, nothing was found";
             }
 
-            cur_posting_list_pos = posting_lists.tellg();
-            posting_lists.seekg(cur_posting_list_pos + sizeof(int64_t));
+            return;
+        }
 
-            int64_t dl;
-            posting_lists.read(reinterpret_cast<char*>(&dl), sizeof(int64_t));
+        std::fstream line_nums;
+        line_nums.open(index_->line_nums, std::ios::binary | std::ios::in);
+        ++stats_.files_opened;
+
+        SnippetReader snippets(index_->line_offsets.c_str(), &stats_, index_->analyzer);
+
+        int64_t k = k_;
+        while (pr.size() != 0 && k > 0) {
+            std::ostringstream out;
+            DocumentPath path = index_->paths.find(pr.top().first, &stats_.bytes_read[PATHS]);
+            std::vector<int64_t> doc_lines;
+
+            // The terms the evaluation matched on the document, in the order of the query.
+            std::vector<TermPosting>& postings = shown_[pr.top().first];
+            std::sort(postings.begin(), postings.end(), [](const TermPosting& a, const TermPosting& b) {
+                return a.term < b.term;
+            });
+            for (const TermPosting& posting : postings) {
+                const std::string& term = all_terms[posting.term];
+                out << "TERM: '" << term << "'\n     ";
+                out << "name of file " << path.path << "   nums of lines: ";
+
+                line_nums.seekg(posting.line_nums_pos);
+
+                int64_t line_nums_count;
+                read(line_nums, LINE_NUMS, &line_nums_count);
+
+                std::vector<int64_t> lines(line_nums_count);
+                for (int64_t j = 0; j < line_nums_count; ++j) {
+                    read(line_nums, LINE_NUMS, &lines[j]);
+                    out << lines[j] << " ";
+                }
+                doc_lines.insert(doc_lines.end(), lines.begin(), lines.end());
 
-            int64_t tf;
-            posting_lists.read(reinterpret_cast<char*>(&tf), sizeof(int64_t));
+                out << '\n';
 
-            cur_posting_list_pos = posting_lists.tellg();
-            posting_lists.seekg(cur_posting_list_pos + sizeof(int64_t));
+                if (snippets_) {
+                    out << snippets.extract(path.path.c_str(), path.line_offsets_pos, lines, context_, term);
+                }
+            }
+            std::sort(doc_lines.begin(), doc_lines.end());
+            doc_lines.erase(std::unique(doc_lines.begin(), doc_lines.end()), doc_lines.end());
+            std::vector<std::string> duplicates;
+            if (const std::vector<std::string>* found = index_->duplicates.find(path.path)) {
+                duplicates = *found;
+                out << "     duplicates:";
+                for (const std::string& duplicate : duplicates) {
+                    out << ' ' << duplicate;
+                }
+                out << '\n';
+            }
+            results_.push_back({pr.top().first, pr.top().second, out.str(), std::move(path.path), std::move(doc_lines),
+                                std::move(duplicates)});
+            if (print_results_) {
+                std::cout << results_.back().text;
+            }
+            pr.pop();
+            --k;
+        }
 
-            posting_lists.close();
+        line_nums.close();
+    }
 
-            return BM25(tf, df, dlavg, dl);
+    // Keeps the postings of a match while it is among the k highest ones.
+    void show(int64_t doc, std::vector<TermPosting> postings) {
+        shown_[doc] = std::move(postings);
+        if (static_cast<int64_t>(shown_.size()) > k_) {
+            shown_.erase(shown_.begin());
         }
     }
 
-    double BM25(int64_t& tf, int64_t& df, int64_t& dlavg, int64_t& dl) {
-        ++tf;
-        double rez = 0.0;
-        double k = 1.2;
-        double b = 0.75;
-
-        double qtw = log((df - df + 0.5) / (df + 0.5));
+        int64_t lookup(const std::string& term) {
+        ++stats_.dictionary_lookups;
 
-        for (int64_t t = 0; t < tf; ++t) {
-            rez += (tf * (k + 1)) / (tf + k * (1 - b + b * static_cast<double>(dl) / dlavg));
-        }
-
-        return rez;
+        return index_->find(term);
     }
 
+    template <typename T>
+    void read(std::fstream& file, IndexFile kind, T* value, int64_t size = sizeof(T)) {
+        file.read(reinterpret_cast<char*>(value), size);
+        stats_.bytes_read[kind] += size;
+    }
 };
@@ -0,0 +1,244 @@
+#pragma once
+#include "../index/generations.hpp"
+#include "../index/shards.hpp"
+#include "search.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Scatter-gather over the shards written by ./index --shards: every shard has a Search of its own
+// rooted at its directory, kept open with its dictionary and caches from query to query. A query
+// runs on all of them at once, one thread per shard, and their top k results, renumbered to the
+// ids of the collection, are merged into the global top k. The shards are reopened when a new
+// generation of the index is published.
+//
+// A term is reported missing only when no shard has it, the other warnings of the shards once.
+//
+// The shards score with the average document length of the whole collection from the manifest.
+// BM25 here has no idf, so no other global statistic is needed for the merged ranking to be the
+// one of a single index.
+class ShardedSearch {
+public:
+    ShardedSearch()
+        : k_(1), max_expansions_(1024), context_(-1), io_backend_(IoBackend::AUTO), evaluation_(Evaluation::AUTO),
+          use_tier_(true), print_warnings_(true), generation_(-1) {}
+
+    void chooseK(int k) {
+        k_ = k;
+        for (auto& shard : shards_) {
+            shard->chooseK(k);
+        }
+    }
+
+    void chooseMaxExpansions(int64_t max_expansions) {
+        max_expansions_ = max_expansions;
+        for (auto& shard : shards_) {
+            shard->chooseMaxExpansions(max_expansions);
+        }
+    }
+
+    void chooseContext(int64_t context) {
+        context_ = context;
+        for (auto& shard : shards_) {
+            shard->chooseContext(context);
+        }
+    }
+
+    void chooseIo(IoBackend backend) {
+        io_backend_ = backend;
+        for (auto& shard : shards_) {
+            shard->chooseIo(backend);
+        }
+    }
+
+    void chooseEvaluation(Evaluation evaluation) {
+        evaluation_ = evaluation;
+        for (auto& shard : shards_) {
+            shard->chooseEvaluation(evaluation);
+        }
+    }
+
+    void useTier(bool enabled) {
+        use_tier_ = enabled;
+        for (auto& shard : shards_) {
+            shard->useTier(enabled);
+        }
+    }
+
+    // With false the warnings are only kept for warnings().
+    void printWarnings(bool enabled) {
+        print_warnings_ = enabled;
+    }
+
+    const std::vector<SearchResult>& results() const {
+        return results_;
+    }
+
+    const std::vector<std::string>& warnings() const {
+        return warnings_;
+    }
+
+    void search(const std::string& input, bool print = true) {
+        open();
+
+        std::vector<std::string> errors(shards_.size());
+        std::vector<std::thread> threads;
+        for (size_t shard = 1; shard < shards_.size(); ++shard) {
+            threads.emplace_back([this, &input, &errors, shard] {
+                searchShard(shard, input, errors[shard]);
+            });
+        }
+        searchShard(0, input, errors[0]);
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (const std::string& error : errors) {
+            if (!error.empty()) {
+                fail(error);
+            }
+        }
+
+        mergeWarnings();
+
+        results_.clear();
+        for (size_t shard = 0; shard < shards_.size(); ++shard) {
+            for (const SearchResult& result : shards_[shard]->results()) {
+                results_.push_back(result);
+                results_.back().doc += first_docs_[shard];
+            }
+        }
+
+        // The same order a single index displays its results in.
+        std::sort(results_.begin(), results_.end(), [](const SearchResult& a, const SearchResult& b) {
+            return a.doc != b.doc ? a.doc > b.doc : a.score > b.score;
+        });
+        if (static_cast<int64_t>(results_.size()) > k_) {
+            results_.resize(k_);
+        }
+
+        if (print) {
+            if (results_.empty()) {
+                std::cout << "--sorry, nothing was found";
+            }
+            for (const SearchResult& result : results_) {
+                std::cout << result.text;
+            }
+        }
+    }
+
+private:
+    int64_t k_;
+    int64_t max_expansions_;
+    int64_t context_;
+    IoBackend io_backend_;
+    Evaluation evaluation_;
+    bool use_tier_;
+    bool print_warnings_;
+    int64_t generation_;
+    std::vector<std::unique_ptr<Search> > shards_;
+    std::vector<int64_t> first_docs_;
+    std::vector<SearchResult> results_;
+    std::vector<std::string> warnings_;
+
+    // A Search per shard of the published generation, opened again only when another one is published.
+    void open() {
+        IndexGenerations generations = IndexGenerations::fromIndexDir();
+        int64_t generation = generations.current();
+        if (!shards_.empty() && generation == generation_) {
+            return;
+        }
+
+        std::string index_dir = std::filesystem::path(trie_p).parent_path().string();
+        setIndexDir(generations.currentDir());
+        ShardManifest manifest;
+        manifest.read();
+        std::vector<std::string> dirs;
+        for (size_t shard = 0; shard < manifest.shards.size(); ++shard) {
+            dirs.push_back(ShardManifest::shardDir(shard));
+        }
+        setIndexDir(index_dir);
+
+        shards_.clear();
+        first_docs_.clear();
+        for (size_t shard = 0; shard < dirs.size(); ++shard) {
+            std::unique_ptr<Search> s(new Search());
+            s->setIndexRoot(dirs[shard]);
+            s->chooseK(k_);
+            s->chooseMaxExpansions(max_expansions_);
+            if (context_ >= 0) {
+                s->chooseContext(context_);
+            }
+            s->chooseIo(io_backend_);
+            s->chooseEvaluation(evaluation_);
+            s->useTier(use_tier_);
+            s->useGlobalAverageLength(manifest.dlavg());
+            s->printResults(false);
+            s->printWarnings(false);
+            s->open();
+            shards_.push_back(std::move(s));
+            first_docs_.push_back(manifest.shards[shard].first_doc);
+        }
+        generation_ = generation;
+    }
+
+    // The warnings of the shards in shard order, each once; a missing term only when every shard misses it.
+    void mergeWarnings() {
+        std::set<std::string> missing_everywhere;
+        for (size_t shard = 0; shard < shards_.size(); ++shard) {
+            std::set<std::string> missing;
+            for (const std::string& warning : shards_[shard]->warnings()) {
+                if (warning.rfind(unknownTermWarning, 0) == 0) {
+                    missing.insert(unknownTerm(warning));
+                }
+            }
+            if (shard == 0) {
+                missing_everywhere = std::move(missing);
+                continue;
+            }
+            std::set<std::string> both;
+            std::set_intersection(missing_everywhere.begin(), missing_everywhere.end(), missing.begin(), missing.end(),
+                                  std::inserter(both, both.begin()));
+            missing_everywhere.swap(both);
+        }
+
+        warnings_.clear();
+        std::set<std::string> reported;
+        for (auto& shard : shards_) {
+            for (const std::string& warning : shard->warnings()) {
+                bool unknown = warning.rfind(unknownTermWarning, 0) == 0;
+                std::string key = unknown ? unknownTerm(warning) : warning;
+                if ((unknown && missing_everywhere.count(key) == 0) || !reported.insert(key).second) {
+                    continue;
+                }
+                warnings_.push_back(warning);
+                if (print_warnings_) {
+                    std::cerr << "--" << warning << '\n';
+                }
+            }
+        }
+    }
+
+    static std::string unknownTerm(const std::string& warning) {
+        std::string rest = warning.substr(unknownTermWarning.size());
+
+        return rest.substr(0, rest.find(','));
+    }
+
+    // A malformed query or a damaged shard is reported by the calling thread once all shards are done.
+    void searchShard(size_t shard, const std::string& input, std::string& error) {
+        ThrowEngineErrors throw_errors;
+        try {
+            std::string query = input;
+            shards_[shard]->createParser(query);
+        } catch (const EngineError& e) {
+            error = e.what();
+        }
+    }
+};
@@ -0,0 +1,244 @@
+#pragma once
+#include "../index/analyzer.hpp"
+#include "../index/dedup.hpp"
+#include "../index/generations.hpp"
+#include "../index/paths.hpp"
+#include "../index/tiers.hpp"
+#include "../trie/term_hash.hpp"
+#include "../trie/errors.hpp"
+#include "cache.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// A displayed result: the document, its score, the lines printed for it, its path, the numbers of
+// the lines the query terms are on and the paths of its duplicates left out of the index.
+struct SearchResult {
+    int64_t doc;
+    double score;
+    std::string text;
+    std::string path;
+    std::vector<int64_t> lines;
+    std::vector<std::string> duplicates;
+};
+
+// Default capacities of the caches kept by a Search between its queries.
+const int64_t defaultResultCacheBytes = 8 << 20;
+const int64_t defaultBlockCacheBytes = 32 << 20;
+
+// The displayed results of a query and the warnings it gave.
+struct CachedQuery {
+    std::vector<SearchResult> results;
+    std::vector<std::string> warnings;
+};
+
+using ResultCache = LruCache<std::string, CachedQuery>;
+
+// One opened generation of the index: the paths of its files, its header, its dictionary, the mapped
+// paths of its documents and the caches of its results and posting blocks. A query holds the snapshot
+// it started on, so a reload swapping in the next generation never changes the files under a running
+// query, and the old snapshot with its caches is freed when the last query using it is done.
+class IndexSnapshot {
+public:
+    IndexSnapshot(const std::string& dir, int64_t generation, int64_t result_cache_bytes, int64_t block_cache_bytes)
+        : posting_lists(path(dir, posting_lists_p)), trie(path(dir, trie_p)),
+          line_nums(path(dir, line_nums_p)), line_offsets(path(dir, line_offsets_p)), generation(generation),
+          results(result_cache_bytes), blocks(block_cache_bytes), trie_(nullptr), lock_(dir) {
+        std::fstream trie_tree;
+        trie_tree.open(trie, std::ios::binary | std::ios::in);
+        trie_tree.read(reinterpret_cast<char*>(&doc_count), sizeof(int64_t));
+        trie_tree.read(reinterpret_cast<char*>(&dlavg), sizeof(int64_t));
+        if (!trie_tree) {
+            fail("index is empty, run ./index first");
+        }
+        trie_tree.close();
+        if (!paths.open(path(dir, files_paths_p)) || paths.size() != doc_count) {
+            fail("the paths of the index are missing or of an older format, run ./index again");
+        }
+
+        std::ifstream term_hash(path(dir, term_hash_p), std::ios::binary);
+        has_term_hash = term_hash_.read(term_hash);
+        analyzer = AnalyzerOptions::load(path(dir, analyzer_p));
+        tier.open(path(dir, tier_p));
+        duplicates.read(path(dir, duplicates_p));
+        if (!has_term_hash) {
+            dictionary();
+        }
+    }
+
+    ~IndexSnapshot() {
+        delete trie_;
+    }
+
+    IndexSnapshot(const IndexSnapshot&) = delete;
+    IndexSnapshot& operator=(const IndexSnapshot&) = delete;
+
+    const std::string posting_lists;
+    const std::string trie;
+    const std::string line_nums;
+    const std::string line_offsets;
+    const int64_t generation;
+    int64_t doc_count;
+    int64_t dlavg;
+    bool has_term_hash;
+    PathStore paths;
+    // Query terms are analyzed the way the index analyzed the documents.
+    AnalyzerOptions analyzer;
+    // Empty when the index was built without a first tier.
+    TierStore tier;
+    DuplicateMap duplicates;
+    ResultCache results;
+    BlockCache blocks;
+
+    // Exact terms are looked up in the hash, the trie is read on the first wildcard, fuzzy or unknown
+    // term, or right away for an index without the hash.
+    int64_t find(const std::string& term) {
+        return has_term_hash ? term_hash_.find(term) : dictionary().find(term);
+    }
+
+    Trie& dictionary() {
+        std::call_once(trie_loaded_, [this] {
+            std::fstream trie_tree;
+            trie_tree.open(trie, std::ios::binary | std::ios::in);
+            trie_tree.seekg(2 * sizeof(int64_t));
+            trie_ = new Trie();
+            trie_ = trie_->saveBackToRAM(trie_tree);
+            trie_tree.close();
+        });
+
+        return *trie_;
+    }
+
+private:
+    TermHash term_hash_;
+    Trie* trie_;
+    std::once_flag trie_loaded_;
+    // Keeps IndexGenerations::prune from removing the files while the snapshot is alive.
+    GenerationLock lock_;
+
+    // The file the global names in dir.
+    static std::string path(const std::string& dir, const char* global) {
+        return (std::filesystem::path(dir) / std::filesystem::path(global).filename()).string();
+    }
+};
+
+// The generation of the index under root that queries start on. Searches sharing one read one
+// dictionary and fill the same caches; the published generation is opened once for all of them.
+class IndexSnapshots {
+public:
+    explicit IndexSnapshots(std::string root = "") : root_(std::move(root)) {}
+
+    IndexSnapshots(const IndexSnapshots&) = delete;
+    IndexSnapshots& operator=(const IndexSnapshots&) = delete;
+
+    // Opens the published generation, see IndexGenerations.
+    void open() {
+        std::shared_ptr<IndexSnapshot> snapshot = openPublished();
+        std::lock_guard<std::mutex> lock(mutex_);
+        current_.swap(snapshot);
+    }
+
+    std::shared_ptr<IndexSnapshot> current() {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        return current_;
+    }
+
+    // The generation a query runs on; with check the published one is opened first when it changed.
+    std::shared_ptr<IndexSnapshot> acquire(bool check) {
+        std::shared_ptr<IndexSnapshot> served = current();
+        if (served != nullptr && (!check || publishedGeneration() == served->generation)) {
+            return served;
+        }
+        std::lock_guard<std::mutex> opening(open_mutex_);
+        served = current();
+        if (served == nullptr || publishedGeneration() != served->generation) {
+            open();
+            served = current();
+        }
+
+        return served;
+    }
+
+    // Swaps in the published generation when it is not the one served, true when it did.
+    bool reload() {
+        std::lock_guard<std::mutex> opening(open_mutex_);
+        std::shared_ptr<IndexSnapshot> served = current();
+        if (served != nullptr && publishedGeneration() == served->generation) {
+            return false;
+        }
+        std::shared_ptr<IndexSnapshot> fresh = openPublished();
+        fresh->dictionary();
+        std::lock_guard<std::mutex> lock(mutex_);
+        current_.swap(fresh);
+
+        return true;
+    }
+
+    const std::string& root() const {
+        return root_;
+    }
+
+    // Capacities in bytes of the caches of the current generation and of the ones opened later.
+    void setResultCacheSize(int64_t bytes) {
+        result_cache_bytes_ = bytes;
+        if (std::shared_ptr<IndexSnapshot> served = current()) {
+            served->results.setCapacity(bytes);
+        }
+    }
+
+    void setBlockCacheSize(int64_t bytes) {
+        block_cache_bytes_ = bytes;
+        if (std::shared_ptr<IndexSnapshot> served = current()) {
+            served->blocks.setCapacity(bytes);
+        }
+    }
+
+    int64_t resultCacheSize() const {
+        return result_cache_bytes_;
+    }
+
+    int64_t blockCacheSize() const {
+        return block_cache_bytes_;
+    }
+
+private:
+    const std::string root_;
+    std::shared_ptr<IndexSnapshot> current_;
+    std::mutex mutex_;
+    std::mutex open_mutex_;
+    std::atomic<int64_t> result_cache_bytes_{defaultResultCacheBytes};
+    std::atomic<int64_t> block_cache_bytes_{defaultBlockCacheBytes};
+
+    IndexGenerations generations() const {
+        return root_.empty() ? IndexGenerations::fromIndexDir() : IndexGenerations(root_);
+    }
+
+    std::shared_ptr<IndexSnapshot> openPublished() const {
+        IndexGenerations published = generations();
+        int64_t generation = published.current();
+        if (generation == -1) {
+            return std::make_shared<IndexSnapshot>(published.root().string(), indexGeneration(published.root()),
+                                                   result_cache_bytes_, block_cache_bytes_);
+        }
+
+        return std::make_shared<IndexSnapshot>(published.dir(generation), generation, result_cache_bytes_, block_cache_bytes_);
+    }
+
+    // The published generation, or for an index without generations a value changing whenever its files are rewritten.
+    int64_t publishedGeneration() const {
+        IndexGenerations published = generations();
+        int64_t generation = published.current();
+
+        return generation == -1 ? indexGeneration(published.root()) : generation;
+    }
+};
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "../index/analyzer.hpp"
+#include "stats.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+// lineOffsets.txt holds, per document, the number of lines followed by the byte offset
+// of every line start and the file size, so any line range maps to one pread.
+class SnippetReader {
+public:
+    explicit SnippetReader(const char* line_offsets_path, QueryStats* stats = nullptr, AnalyzerOptions options = {})
+        : stats_(stats), analyzer_(options) {
+        offsets_fd = open(line_offsets_path, O_RDONLY);
+        count(&QueryStats::files_opened, 1);
+    }
+
+    ~SnippetReader() {
+        if (offsets_fd != -1) {
+            close(offsets_fd);
+        }
+    }
+
+    SnippetReader(const SnippetReader&) = delete;
+    SnippetReader& operator=(const SnippetReader&) = delete;
+
+    std::string extract(const char* path, int64_t line_offsets_pos, const std::vector<int64_t>& lines, int64_t context, const std::string& term) {
+        std::string snippet;
+        if (offsets_fd == -1 || lines.empty()) {
+            return snippet;
+        }
+
+        int64_t lines_count;
+        if (!readAt(offsets_fd, LINE_OFFSETS, &lines_count, sizeof(int64_t), line_offsets_pos)) {
+            return snippet;
+        }
+
+        int fd = open(path, O_RDONLY);
+        if (fd == -1) {
+            return snippet;
+        }
+        count(&QueryStats::files_opened, 1);
+
+        size_t i = 0;
+        while (i < lines.size()) {
+            int64_t first = std::max<int64_t>(1, lines[i] - context);
+            int64_t last = std::min(lines_count, lines[i] + context);
+            while (i + 1 < lines.size() && lines[i + 1] - context <= last + 1) {
+                ++i;
+                last = std::min(lines_count, lines[i] + context);
+            }
+            ++i;
+
+            int64_t begin;
+            int64_t end;
+            readAt(offsets_fd, LINE_OFFSETS, &begin, sizeof(int64_t), line_offsets_pos + first * sizeof(int64_t));
+            readAt(offsets_fd, LINE_OFFSETS, &end, sizeof(int64_t), line_offsets_pos + (last + 1) * sizeof(int64_t));
+
+            std::string block(end - begin, '\0');
+            if (!readAt(fd, DOCUMENTS, block.data(), block.size(), begin)) {
+                break;
+            }
+
+            if (!snippet.empty()) {
+                snippet += "        ...\n";
+            }
+
+            size_t line_begin = 0;
+            for (int64_t line = first; line <= last; ++line) {
+                size_t line_end = block.find('\n', line_begin);
+                if (line_end == std::string::npos) {
+                    line_end = block.size();
+                }
+                std::string text = block.substr(line_begin, line_end - line_begin);
+                if (!text.empty() && text.back() == '\r') {
+                    text.pop_back();
+                }
+                snippet += "        " + std::to_string(line) + ": " + highlight(text, term) + '\n';
+                line_begin = line_end + 1;
+            }
+        }
+
+        close(fd);
+
+        return snippet;
+    }
+
+private:
+    int offsets_fd;
+    QueryStats* stats_;
+    Analyzer analyzer_;
+    std::string term_;
+
+    void count(int64_t QueryStats::* counter, int64_t by) {
+        if (stats_) {
+            stats_->*counter += by;
+        }
+    }
+
+    bool readAt(int fd, IndexFile kind, void* buffer, size_t size, int64_t pos) {
+        if (stats_) {
+            stats_->bytes_read[kind] += size;
+        }
+        char* out = static_cast<char*>(buffer);
+        while (size > 0) {
+            ssize_t got = pread(fd, out, size, pos);
+            if (got <= 0) {
+                return false;
+            }
+            out += got;
+            size -= got;
+            pos += got;
+        }
+        return true;
+    }
+
+    // The words analyzed into term are highlighted, so with stemming "cats" is highlighted for cat.
+    std::string highlight(const std::string& text, const std::string& term) {
+        std::string rez;
+        size_t pos = 0;
+        size_t copied = 0;
+        std::string_view token;
+        while (Analyzer::nextToken(text, pos, token)) {
+            size_t begin = token.data() - text.data();
+            rez.append(text, copied, begin - copied);
+            if (analyzer_.analyze(token, term_) && term_ == term) {
+                rez += '[';
+                rez += token;
+                rez += ']';
+            } else {
+                rez += token;
+            }
+            copied = pos;
+        }
+        rez.append(text, copied);
+
+        return rez;
+    }
+};
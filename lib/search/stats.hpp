@@ -0,0 +1,114 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+enum IndexFile {
+    POSTINGS,
+    PATHS,
+    LINE_NUMS,
+    LINE_OFFSETS,
+    DOCUMENTS,
+    INDEX_FILES_COUNT,
+};
+
+const char* const index_file_names[INDEX_FILES_COUNT] = {
+    "postinglists", "files", "numbersOfLines", "lineOffsets", "documents",
+};
+
+// Counters of one query. They are plain increments next to file reads, so they are always kept;
+// the clock and /proc reads happen only when collection is enabled.
+struct QueryStats {
+    int64_t dictionary_lookups = 0;
+    int64_t postings_decoded = 0;
+    int64_t postings_skipped = 0;
+    int64_t documents_scored = 0;
+    int64_t heap_insertions = 0;
+    int64_t bitmaps_read = 0;
+    int64_t candidates = 0;
+    int64_t bytes_read[INDEX_FILES_COUNT] = {};
+    int64_t files_opened = 0;
+    int64_t async_reads = 0;
+    bool result_cache_hit = false;
+    int64_t block_cache_hits = 0;
+    int64_t block_cache_misses = 0;
+    const char* io_backend = "";
+    const char* evaluation = "";
+    bool tier_fallback = false;
+    int64_t read_syscalls = 0;
+
+    double parse_ms = 0;
+    double plan_ms = 0;
+    double evaluate_ms = 0;
+    double render_ms = 0;
+
+    std::string toJson() const {
+        std::ostringstream out;
+        out << "{\"dictionary_lookups\":" << dictionary_lookups
+            << ",\"postings_decoded\":" << postings_decoded
+            << ",\"postings_skipped\":" << postings_skipped
+            << ",\"documents_scored\":" << documents_scored
+            << ",\"heap_insertions\":" << heap_insertions
+            << ",\"bitmaps_read\":" << bitmaps_read
+            << ",\"candidates\":" << candidates
+            << ",\"evaluation\":\"" << evaluation << '"'
+            << ",\"tier_fallback\":" << (tier_fallback ? "true" : "false")
+            << ",\"bytes_read\":{";
+        for (int i = 0; i < INDEX_FILES_COUNT; ++i) {
+            out << (i ? "," : "") << '"' << index_file_names[i] << "\":" << bytes_read[i];
+        }
+        out << "},\"files_opened\":" << files_opened
+            << ",\"io_backend\":\"" << io_backend << '"'
+            << ",\"async_reads\":" << async_reads
+            << ",\"read_syscalls\":" << read_syscalls
+            << ",\"cache\":{\"result_hit\":" << (result_cache_hit ? "true" : "false")
+            << ",\"block_hits\":" << block_cache_hits
+            << ",\"block_misses\":" << block_cache_misses << '}'
+            << ",\"phases_ms\":{\"parse\":" << parse_ms
+            << ",\"plan\":" << plan_ms
+            << ",\"evaluate\":" << evaluate_ms
+            << ",\"render\":" << render_ms << "}}";
+
+        return out.str();
+    }
+};
+
+// Measures consecutive phases: every lap() adds the time since the previous one.
+class PhaseClock {
+public:
+    explicit PhaseClock(bool enabled) : enabled_(enabled) {
+        if (enabled_) {
+            last_ = std::chrono::steady_clock::now();
+        }
+    }
+
+    void lap(double& phase_ms) {
+        if (!enabled_) {
+            return;
+        }
+        auto now = std::chrono::steady_clock::now();
+        phase_ms += std::chrono::duration<double, std::milli>(now - last_).count();
+        last_ = now;
+    }
+
+private:
+    bool enabled_;
+    std::chrono::steady_clock::time_point last_;
+};
+
+// Number of read syscalls issued by the process so far, 0 where /proc/self/io is not available.
+inline int64_t readSyscallsSoFar() {
+    std::ifstream io("/proc/self/io");
+    std::string key;
+    int64_t value;
+    while (io >> key >> value) {
+        if (key == "syscr:") {
+            return value;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,83 @@
+#pragma once
+#include "../index/runs.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Term at a time evaluation of a query ORing its terms: the posting lists are scored one after the
+// other into a dense array of per-document scores, then the array is scanned for the results.
+
+// Adds weight * BM25 of every posting to the score of its document, the BM25 of four postings at once.
+// BM25() sums tf equal terms, here they are multiplied.
+inline void accumulateBM25(const DID* postings, int64_t count, double weight, int64_t dlavg, float* scores) {
+    const float k = 1.2f;
+    const float b = 0.75f;
+    const float length_base = k * (1 - b);
+    const float length_factor = k * b / dlavg;
+    const float numerator_factor = (k + 1) * static_cast<float>(weight);
+
+    alignas(16) float tf[4];
+    alignas(16) float dl[4];
+    alignas(16) float score[4];
+    int64_t i = 0;
+#if defined(__SSE2__)
+    const __m128 base = _mm_set1_ps(length_base);
+    const __m128 length = _mm_set1_ps(length_factor);
+    const __m128 numerator = _mm_set1_ps(numerator_factor);
+    for (; i + 4 <= count; i += 4) {
+        for (int j = 0; j < 4; ++j) {
+            tf[j] = static_cast<float>(postings[i + j].tf);
+            dl[j] = static_cast<float>(postings[i + j].dl);
+        }
+        __m128 t = _mm_load_ps(tf);
+        __m128 norm = _mm_add_ps(_mm_add_ps(t, base), _mm_mul_ps(length, _mm_load_ps(dl)));
+        _mm_store_ps(score, _mm_div_ps(_mm_mul_ps(_mm_mul_ps(t, t), numerator), norm));
+        for (int j = 0; j < 4; ++j) {
+            scores[postings[i + j].ind] += score[j];
+        }
+    }
+#endif
+    for (; i < count; ++i) {
+        float t = static_cast<float>(postings[i].tf);
+        float norm = t + length_base + length_factor * static_cast<float>(postings[i].dl);
+        scores[postings[i].ind] += t * t * numerator_factor / norm;
+    }
+}
+
+// The k highest documents with a positive score, highest first: the order the cursor evaluation pops
+// its results in. Only the top of the array is read, four scores at a time, until k are found.
+inline std::vector<std::pair<int64_t, float> > topDocuments(const float* scores, int64_t doc_count, int64_t k) {
+    std::vector<std::pair<int64_t, float> > rez;
+    int64_t doc = doc_count;
+    while (doc % 4 != 0 && static_cast<int64_t>(rez.size()) < k) {
+        --doc;
+        if (scores[doc] > 0) {
+            rez.push_back({doc, scores[doc]});
+        }
+    }
+#if defined(__SSE2__)
+    const __m128 zero = _mm_setzero_ps();
+    for (; doc > 0 && static_cast<int64_t>(rez.size()) < k; doc -= 4) {
+        int mask = _mm_movemask_ps(_mm_cmpgt_ps(_mm_loadu_ps(scores + doc - 4), zero));
+        for (int j = 3; j >= 0 && mask != 0 && static_cast<int64_t>(rez.size()) < k; --j) {
+            if (mask & (1 << j)) {
+                rez.push_back({doc - 4 + j, scores[doc - 4 + j]});
+            }
+        }
+    }
+#endif
+    for (; doc > 0 && static_cast<int64_t>(rez.size()) < k;) {
+        --doc;
+        if (scores[doc] > 0) {
+            rez.push_back({doc, scores[doc]});
+        }
+    }
+
+    return rez;
+}
@@ -1,10 +1,20 @@
 #include <gtest/gtest.h>
 
+#include "../engine/engine.hpp"
+#include "../index/analyzer.hpp"
 #include "../index/index.hpp"
+#include "../index/shards.hpp"
+#include "../index/tiers.hpp"
+#include "../inspect/inspect.hpp"
+#include "../load/load.hpp"
 #include "../search/search.hpp"
+#include "../search/shards.hpp"
+#include "../trie/term_hash.hpp"
 #include "../trie/trie.hpp"
+#include "../warmup/warmup.hpp"
 
 #include <sstream>
+#include <thread>
 
 class SimpleSearchEngineTest : public testing::Test {
 protected:
@@ -39,6 +49,11 @@ TEST_F(ParserTest, parse) {
     EXPECT_TRUE(parse("(vector AND list)"));
     EXPECT_TRUE(parse("(while OR for) AND vector"));
     EXPECT_TRUE(parse("for AND and"));
+    EXPECT_TRUE(parse("vec*"));
+    EXPECT_TRUE(parse("*tor AND (li*t OR for)"));
+    EXPECT_TRUE(parse("vectr~1 OR lst~"));
+    EXPECT_TRUE(parse("vector AND NOT list"));
+    EXPECT_TRUE(parse("(vector OR list) NOT (for AND while)"));
 }
 
 TEST_F(ParserDeathTest, parseDeath) {
@@ -63,12 +78,77 @@ TEST_F(ParserDeathTest, parseDeath) {
         "--unexpected token in factor"
     );
 
+    EXPECT_EXIT({
+            parse("NOT vector");
+        },
+        testing::ExitedWithCode(EXIT_FAILURE),
+        "--unexpected token in factor"
+    );
+
     EXPECT_EXIT({
             parse("vector Or list");
         },
         testing::ExitedWithCode(EXIT_FAILURE),
         "--unexpected tokens after expression"
     );
+
+    EXPECT_EXIT({
+            parse("pupa~99999999999999999999");
+        },
+        testing::ExitedWithCode(EXIT_FAILURE),
+        "--fuzzy distance is at most 2"
+    );
+
+    EXPECT_EXIT({
+            parse("pupa~3");
+        },
+        testing::ExitedWithCode(EXIT_FAILURE),
+        "--fuzzy distance is at most 2"
+    );
+}
+
+TEST(RoaringTest, SetOperations) {
+    // Sparse, dense (bitset containers) and chunk-crossing sets.
+    std::vector<int64_t> a;
+    std::vector<int64_t> b;
+    for (int64_t doc = 0; doc < 200000; ++doc) {
+        if (doc % 3 == 0 || (doc > 70000 && doc < 80000)) {
+            a.push_back(doc);
+        }
+        if (doc % 7 == 0 || doc % 65536 == 5) {
+            b.push_back(doc);
+        }
+    }
+    Roaring x;
+    Roaring y;
+    for (int64_t doc : a) {
+        x.add(doc);
+    }
+    for (int64_t doc : b) {
+        y.add(doc);
+    }
+
+    std::vector<int64_t> expected;
+    std::set_intersection(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    EXPECT_EQ(Roaring::And(x, y).toVector(), expected);
+
+    expected.clear();
+    std::set_union(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    EXPECT_EQ(Roaring::Or(x, y).toVector(), expected);
+
+    expected.clear();
+    std::set_difference(a.begin(), a.end(), b.begin(), b.end(), std::back_inserter(expected));
+    EXPECT_EQ(Roaring::AndNot(x, y).toVector(), expected);
+
+    EXPECT_EQ(x.rank(0), 0);
+    EXPECT_EQ(x.rank(75001), std::lower_bound(a.begin(), a.end(), 75001) - a.begin());
+    EXPECT_EQ(y.rank(131077), std::lower_bound(b.begin(), b.end(), 131077) - b.begin());
+
+    std::stringstream file;
+    y.write(file);
+    Roaring z;
+    z.read(file);
+    EXPECT_EQ(z.toVector(), b);
 }
 
 TEST_F(SimpleSearchEngineTest, K1) {
@@ -239,7 +319,7 @@ TEST_F(SimpleSearchEngineTest, OR_K1_InDifferentFiles) {
     std::string output = buffer.str();
 
     EXPECT_FALSE(output.empty());
-    EXPECT_EQ(output, "TERM: 'hello'\n     name of file ../../test/3.txt   nums of lines: 8 \n");
+    EXPECT_EQ(output, "TERM: 'heheheheh'\n     name of file ../../test/1.txt   nums of lines: 2 9 15 \n");
 }
 
 TEST_F(SimpleSearchEngineTest, AND_K1_InDifferentFiles) {
@@ -259,8 +339,1043 @@ TEST_F(SimpleSearchEngineTest, AND_K1_InDifferentFiles) {
     EXPECT_EQ(output, "--sorry, nothing was found");
 }
 
+TEST_F(SimpleSearchEngineTest, SnippetsWithContext) {
+    ii.erase();
+    ii.traverse("../../test");
+
+    Search snippets;
+    snippets.chooseK(3);
+    snippets.chooseContext(1);
+    std::string input = "papulya";
+
+    std::stringstream buffer;
+    std::streambuf* coutbuf = std::cout.rdbuf(buffer.rdbuf());
+    snippets.createParser(input);
+    std::cout.rdbuf(coutbuf);
+    std::string output = buffer.str();
+
+    EXPECT_NE(output.find("name of file ../../test/3.txt   nums of lines: 3 7 \n"
+                          "        2: \n"
+                          "        3: [papulya]\n"
+                          "        4: Pupa\n"
+                          "        ...\n"
+                          "        6: Pupa pupa\n"
+                          "        7: [papulya]\n"
+                          "        8: hello\n"), std::string::npos);
+    EXPECT_NE(output.find("name of file ../../test/2.txt   nums of lines: 9 \n"
+                          "        8: \n"
+                          "        9: [papulya]\n"), std::string::npos);
+}
+
+TEST_F(SimpleSearchEngineTest, QueryStats) {
+    ii.erase();
+    ii.traverse("../../test");
+
+    s.chooseK(3);
+    s.collectStats(true);
+    std::string input = "pupa AND papulya";
+
+    std::stringstream buffer;
+    std::streambuf* coutbuf = std::cout.rdbuf(buffer.rdbuf());
+    s.createParser(input);
+    std::cout.rdbuf(coutbuf);
+
+    const QueryStats& stats = s.stats();
+    EXPECT_GT(stats.dictionary_lookups, 0);
+    EXPECT_GT(stats.postings_decoded, 0);
+    EXPECT_EQ(stats.heap_insertions, 2);
+    EXPECT_GT(stats.bytes_read[POSTINGS], 0);
+    EXPECT_GT(stats.bytes_read[PATHS], 0);
+    EXPECT_EQ(stats.bytes_read[DOCUMENTS], 0);
+
+    std::string json = stats.toJson();
+    EXPECT_EQ(json.front(), '{');
+    EXPECT_NE(json.find("\"heap_insertions\":2"), std::string::npos);
+    EXPECT_NE(json.find("\"phases_ms\":{\"parse\":"), std::string::npos);
+}
+
+TEST_F(SimpleSearchEngineTest, IndexTelemetry) {
+    ii.erase();
+    ii.traverse("../../test");
+
+    const IndexTelemetry& telemetry = ii.telemetry();
+    EXPECT_EQ(telemetry.docs, 3);
+    EXPECT_EQ(telemetry.input_bytes, 161);
+    EXPECT_EQ(telemetry.vocabulary, 6);
+    EXPECT_GT(telemetry.trie_nodes, telemetry.vocabulary);
+    EXPECT_GE(telemetry.phases_s[ACCUMULATE], 0);
+
+    std::string json = telemetry.toJson();
+    EXPECT_NE(json.find("\"docs\":3,\"input_bytes\":161"), std::string::npos);
+    EXPECT_NE(json.find("\"dictionary_write\":"), std::string::npos);
+}
+
+TEST_F(SimpleSearchEngineTest, MemoryLimitSpillsRuns) {
+    auto search = [](const std::string& query) {
+        Search s;
+        s.chooseK(3);
+        std::string input = query;
+
+        std::stringstream buffer;
+        std::streambuf* coutbuf = std::cout.rdbuf(buffer.rdbuf());
+        s.createParser(input);
+        std::cout.rdbuf(coutbuf);
+
+        return buffer.str();
+    };
+
+    ii.erase();
+    ii.traverse("../../test");
+    EXPECT_EQ(ii.telemetry().runs, 0);
+    std::string in_memory = search("pupa OR papulya") + search("lupa AND heheheheh");
+
+    InvertedIndex limited;
+    limited.setMemoryLimit(1);
+    limited.erase();
+    limited.traverse("../../test");
+    EXPECT_EQ(limited.telemetry().runs, 3);
+    EXPECT_GT(limited.telemetry().run_bytes, 0);
+    EXPECT_FALSE(fs::exists("../trash/runs/run0"));
+
+    EXPECT_EQ(search("pupa OR papulya") + search("lupa AND heheheheh"), in_memory);
+}
+
+std::vector<std::string> analyzeAll(const std::string& text, AnalyzerOptions options = {}) {
+    Analyzer analyzer(options);
+    std::vector<std::string> terms;
+    std::string term;
+    size_t pos = 0;
+    std::string_view token;
+    while (Analyzer::nextToken(text, pos, token)) {
+        if (analyzer.analyze(token, term)) {
+            terms.push_back(term);
+        }
+    }
+
+    return terms;
+}
+
+TEST(TrieTest, MatchesInLexicographicOrder) {
+    Trie trie;
+    int64_t pos = 0;
+    for (const char* term : {"pupb", "lupa", "pupa", "pup", "pupab", "pupaa", "pz"}) {
+        trie.insert(term, pos++);
+    }
+    std::vector<TermMatch> terms;
+    trie.match("pup*", 3, terms);
+    std::vector<std::string> found;
+    for (const TermMatch& term : terms) {
+        found.push_back(term.term);
+    }
+    EXPECT_EQ(found, (std::vector<std::string>{"pup", "pupa", "pupaa"}));
+}
+
+TEST(AnalyzerTest, SplitsAndFolds) {
+    EXPECT_EQ(analyzeAll("Hello, WORLD!hello-world  x"), std::vector<std::string>({"hello", "world", "hello", "world", "x"}));
+    EXPECT_EQ(analyzeAll("\xC3\x89" "COLE \xD0\x9F\xD0\xA0\xD0\x98 \xE2\x80\x94 \xCE\xA3\xCE\xB9"),
+              std::vector<std::string>({"\xC3\xA9" "cole", "\xD0\xBF\xD1\x80\xD0\xB8", "\xCF\x83\xCE\xB9"}));
+    EXPECT_EQ(analyzeAll("a\xFF\xC3" "b"), std::vector<std::string>({"a", "b"}));
+}
+
+TEST(AnalyzerTest, StopwordsAndStemming) {
+    AnalyzerOptions options;
+    options.flags = AnalyzerOptions::STOPWORDS | AnalyzerOptions::STEMMING;
+    EXPECT_EQ(analyzeAll("The cats and the flies of glass boxes", options),
+              std::vector<std::string>({"cat", "fly", "glass", "boxe"}));
+    EXPECT_EQ(analyzeAll("The cats"), std::vector<std::string>({"the", "cats"}));
+}
+
+TEST_F(SimpleSearchEngineTest, StopwordsLeaveTheQuery) {
+    AnalyzerOptions options;
+    options.flags = AnalyzerOptions::STOPWORDS;
+    ii.setAnalyzer(options);
+    ii.erase();
+    ii.traverse("../../test");
+
+    auto search = [](const std::string& query, std::vector<std::string>* warnings = nullptr) {
+        Search s;
+        s.chooseK(3);
+        s.printWarnings(false);
+        s.setResultCacheSize(0);
+        std::string input = query;
+
+        std::stringstream buffer;
+        std::streambuf* coutbuf = std::cout.rdbuf(buffer.rdbuf());
+        s.createParser(input);
+        std::cout.rdbuf(coutbuf);
+        if (warnings != nullptr) {
+            *warnings = s.warnings();
+        }
+
+        return buffer.str();
+    };
+
+    std::vector<std::string> warnings;
+    EXPECT_EQ(search("the AND pupa", &warnings), search("pupa"));
+    EXPECT_EQ(warnings, std::vector<std::string>({"the is a stopword, stopwords are not indexed"}));
+    EXPECT_EQ(search("(pupa AND the) OR (hello AND a)"), search("pupa OR hello"));
+    EXPECT_EQ(search("pupa NOT the"), search("pupa"));
+    EXPECT_EQ(search("the NOT pupa"), "--sorry, nothing was found");
+    EXPECT_EQ(search("the OR a", &warnings), "--sorry, nothing was found");
+    EXPECT_EQ(warnings.size(), 2);
+}
+
+TEST(TermHashTest, MinimalPerfect) {
+    std::vector<TermMatch> terms;
+    for (int64_t i = 0; i < 5000; ++i) {
+        terms.push_back({"term" + std::to_string(i), i * 40, 0});
+    }
+    TermHash hash;
+    hash.build(terms);
+
+    std::stringstream file;
+    hash.write(file);
+    TermHash loaded;
+    ASSERT_TRUE(loaded.read(file));
+
+    std::vector<bool> used(terms.size(), false);
+    for (const TermMatch& term : terms) {
+        int64_t ord = loaded.ordinal(term.term);
+        ASSERT_GE(ord, 0);
+        ASSERT_LT(ord, static_cast<int64_t>(terms.size()));
+        EXPECT_FALSE(used[ord]);
+        used[ord] = true;
+        EXPECT_EQ(loaded.find(term.term), term.posting_list_pos);
+    }
+    EXPECT_EQ(loaded.find("term5000"), -1);
+    EXPECT_EQ(loaded.find(""), -1);
+    EXPECT_LT(hash.bitsPerTerm(), 5.0);
+}
+
+TEST(PathStoreTest, FrontCodedLookup) {
+    std::vector<std::string> paths;
+    int64_t raw = 0;
+    for (int64_t i = 0; i < 1000; ++i) {
+        paths.push_back("/data/collection/part" + std::to_string(i / 100) + "/document" + std::to_string(i) + ".txt");
+        raw += sizeof(int64_t) + paths.back().size() + sizeof(int64_t);
+    }
+    paths.push_back("");
+    paths.push_back("/other");
+    PathStoreWriter writer;
+    for (size_t doc = 0; doc < paths.size(); ++doc) {
+        writer.add(paths[doc], doc * 1000);
+    }
+    std::string file = (fs::path(trie_p).parent_path() / "pathStoreTest.txt").string();
+    writer.write(file.c_str());
+
+    PathStore store;
+    ASSERT_TRUE(store.open(file));
+    ASSERT_EQ(store.size(), static_cast<int64_t>(paths.size()));
+    for (int64_t doc = paths.size() - 1; doc >= 0; --doc) {
+        DocumentPath entry = store.find(doc);
+        EXPECT_EQ(entry.path, paths[doc]);
+        EXPECT_EQ(entry.line_offsets_pos, doc * 1000);
+    }
+    EXPECT_LT(fs::file_size(file) * 3, raw);
+    fs::remove(file);
+}
+
+TEST_F(SimpleSearchEngineTest, Wildcards) {
+    ii.erase();
+    ii.traverse("../../test");
+
+    auto search = [this](const std::string& query) {
+        s.chooseK(3);
+        std::string input = query;
+
+        std::stringstream buffer;
+        std::streambuf* coutbuf = std::cout.rdbuf(buffer.rdbuf());
+        s.createParser(input);
+        std::cout.rdbuf(coutbuf);
+
+        return buffer.str();
+    };
+
+    std::string prefix = search("pup*");
+    EXPECT_NE(prefix.find("TERM: 'pupochka'\n     name of file ../../test/2.txt   nums of lines: 3 \n"), std::string::npos);
+    EXPECT_NE(prefix.find("TERM: 'pupa'\n     name of file ../../test/3.txt   nums of lines: 1 4 5 6 \n"), std::string::npos);
+    EXPECT_EQ(prefix.find("papulya"), std::string::npos);
+
+    EXPECT_EQ(search("*ulya"), search("papulya"));
+    EXPECT_EQ(search("p*l*a AND h*"), search("papulya AND (heheheheh OR hello)"));
+    EXPECT_EQ(search("zz*"), "--sorry, nothing was found");
+
+    s.chooseMaxExpansions(1);
+    EXPECT_EQ(search("pup*"), search("pupa"));
+}
+
+TEST_F(SimpleSearchEngineTest, Fuzzy) {
+    ii.erase();
+    ii.traverse("../../test");
+
+    auto search = [this](const std::string& query) {
+        s.chooseK(3);
+        std::string input = query;
+
+        std::stringstream buffer;
+        std::streambuf* coutbuf = std::cout.rdbuf(buffer.rdbuf());
+        s.createParser(input);
+        std::cout.rdbuf(coutbuf);
+
+        return buffer.str();
+    };
+
+    EXPECT_EQ(search("papula~1"), search("papulya"));
+    EXPECT_EQ(search("papula~0"), "--sorry, nothing was found");
+    EXPECT_EQ(search("pupochak~2"), search("pupochka"));
+    EXPECT_EQ(search("papula OR pupochka"), search("pupochka"));
+    EXPECT_EQ(search("papula AND pupochka"), "--sorry, nothing was found");
+}
+
+TEST_F(SimpleSearchEngineTest, Not) {
+    ii.erase();
+    ii.traverse("../../test");
+
+    auto search = [this](const std::string& query) {
+        s.chooseK(3);
+        std::string input = query;
+
+        std::stringstream buffer;
+        std::streambuf* coutbuf = std::cout.rdbuf(buffer.rdbuf());
+        s.createParser(input);
+        std::cout.rdbuf(coutbuf);
+
+        return buffer.str();
+    };
+
+    std::string rez = search("pupa NOT lupa");
+    EXPECT_EQ(rez, "TERM: 'pupa'\n     name of file ../../test/3.txt   nums of lines: 1 4 5 6 \n");
+    EXPECT_EQ(search("pupa AND NOT lupa"), rez);
+    EXPECT_EQ(search("(pupa OR papulya) NOT (pupa OR hello)"),
+              "TERM: 'papulya'\n     name of file ../../test/2.txt   nums of lines: 9 \n");
+    EXPECT_EQ(search("papulya NOT papulya"), "--sorry, nothing was found");
+}
+
+TEST_F(SimpleSearchEngineTest, IoBackends) {
+    ii.erase();
+    ii.traverse("../../test");
+
+    auto search = [](IoBackend backend, const std::string& query) {
+        Search search;
+        search.chooseK(3);
+        search.chooseIo(backend);
+        std::string input = query;
+
+        std::stringstream buffer;
+        std::streambuf* coutbuf = std::cout.rdbuf(buffer.rdbuf());
+        search.createParser(input);
+        std::cout.rdbuf(coutbuf);
+
+        return buffer.str();
+    };
+
+    for (const std::string query : {"pupa", "lupa OR hello", "papulya AND NOT hello", "p* AND lupa~1"}) {
+        std::string expected = search(IoBackend::SYNC, query);
+        EXPECT_EQ(search(IoBackend::THREADS, query), expected) << query;
+        EXPECT_EQ(search(IoBackend::AUTO, query), expected) << query;
+    }
+}
+
+TEST_F(SimpleSearchEngineTest, TermAtATimeMatchesCursors) {
+    ii.erase();
+    ii.traverse("../../test");
+
+    auto search = [](Search& search, Evaluation evaluation, const std::string& query) {
+        search.chooseK(5);
+        search.chooseEvaluation(evaluation);
+        search.printResults(false);
+        search.setResultCacheSize(0);
+        std::string input = query;
+        search.createParser(input);
+    };
+
+    for (const std::string query : {"pupa", "lupa OR hello", "p* OR lupa~1 OR hello"}) {
+        Search cursors;
+        Search accumulator;
+        search(cursors, Evaluation::DOCUMENT_AT_A_TIME, query);
+        search(accumulator, Evaluation::TERM_AT_A_TIME, query);
+        EXPECT_STREQ(accumulator.stats().evaluation, "taat") << query;
+        ASSERT_EQ(accumulator.results().size(), cursors.results().size()) << query;
+        for (size_t i = 0; i < cursors.results().size(); ++i) {
+            EXPECT_EQ(accumulator.results()[i].doc, cursors.results()[i].doc) << query;
+            EXPECT_EQ(accumulator.results()[i].text, cursors.results()[i].text) << query;
+            EXPECT_NEAR(accumulator.results()[i].score, cursors.results()[i].score, 1e-4 * cursors.results()[i].score) << query;
+        }
+    }
+
+    Search planned;
+    search(planned, Evaluation::AUTO, "lupa OR hello");
+    EXPECT_STREQ(planned.stats().evaluation, "taat");
+    search(planned, Evaluation::AUTO, "lupa AND hello");
+    EXPECT_STREQ(planned.stats().evaluation, "daat");
+}
+
+TEST_F(SimpleSearchEngineTest, WideWildcardDisplaysMatchedTerms) {
+    fs::path dir = fs::path(trie_p).parent_path() / "wildcardTest";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    std::vector<std::string> words;
+    for (int i = 0; i < 40; ++i) {
+        words.push_back(std::string{'w', static_cast<char>('a' + i % 26), static_cast<char>('a' + i / 26)});
+    }
+    auto write = [&](const std::string& name, int64_t first, int64_t last) {
+        std::ofstream file(dir / name);
+        for (int64_t i = first; i < last; ++i) {
+            file << words[i] << '\n';
+        }
+        file << "other\n";
+    };
+    write("a.txt", 0, 30);
+    write("b.txt", 10, 40);
+    write("c.txt", 0, 0);
+    ii.erase();
+    ii.traverse(dir.string());
+
+    // More expansions than a heap union takes, the postings of the display come from the evaluation.
+    for (Evaluation evaluation : {Evaluation::DOCUMENT_AT_A_TIME, Evaluation::TERM_AT_A_TIME}) {
+        Search search;
+        search.chooseK(3);
+        search.chooseEvaluation(evaluation);
+        search.printResults(false);
+        search.setResultCacheSize(0);
+        std::string input = "w*";
+        search.createParser(input);
+        EXPECT_EQ(search.stats().dictionary_lookups, 1);
+        ASSERT_EQ(search.results().size(), 2);
+        for (const SearchResult& result : search.results()) {
+            bool first = fs::path(result.path).filename() == "a.txt";
+            std::vector<std::string> expected(words.begin() + (first ? 0 : 10), words.begin() + (first ? 30 : 40));
+            std::sort(expected.begin(), expected.end());
+            std::vector<std::string> shown;
+            std::istringstream text(result.text);
+            for (std::string line; std::getline(text, line);) {
+                if (line.rfind("TERM: '", 0) == 0) {
+                    shown.push_back(line.substr(7, line.size() - 8));
+                }
+            }
+            EXPECT_EQ(shown, expected) << result.path;
+            EXPECT_EQ(result.lines.size(), 30);
+        }
+    }
+    fs::remove_all(dir);
+}
+
+TEST(CacheTest, EvictsLeastRecentlyUsedByBytes) {
+    LruCache<int, std::string> cache(100);
+    cache.put(1, std::make_shared<std::string>("a"), 40);
+    cache.put(2, std::make_shared<std::string>("b"), 40);
+    ASSERT_NE(cache.get(1), nullptr);
+    cache.put(3, std::make_shared<std::string>("c"), 40);
+    EXPECT_EQ(cache.get(2), nullptr);
+    EXPECT_EQ(*cache.get(1), "a");
+    EXPECT_EQ(*cache.get(3), "c");
+    EXPECT_EQ(cache.bytes(), 80);
+    EXPECT_EQ(cache.hits(), 3);
+    EXPECT_EQ(cache.misses(), 1);
+    EXPECT_EQ(cache.evictions(), 1);
+
+    cache.put(4, std::make_shared<std::string>("d"), 200);
+    EXPECT_EQ(cache.get(4), nullptr);
+}
+
+TEST_F(SimpleSearchEngineTest, CachedQueries) {
+    ii.erase();
+    ii.traverse("../../test");
+
+    auto run = [this](const std::string& query) {
+        std::string input = query;
+        std::stringstream buffer;
+        std::streambuf* coutbuf = std::cout.rdbuf(buffer.rdbuf());
+        s.createParser(input);
+        std::cout.rdbuf(coutbuf);
+
+        return buffer.str();
+    };
+
+    s.chooseK(3);
+    std::string first = run("lupa OR hello");
+    EXPECT_FALSE(s.stats().result_cache_hit);
+    EXPECT_EQ(run("(LUPA  OR hello)"), first);
+    EXPECT_TRUE(s.stats().result_cache_hit);
+
+    s.printWarnings(false);
+    run("lupa OR helo");
+    std::vector<std::string> warnings = s.warnings();
+    EXPECT_FALSE(warnings.empty());
+    run("lupa OR helo");
+    EXPECT_TRUE(s.stats().result_cache_hit);
+    EXPECT_EQ(s.warnings(), warnings);
+
+    s.setResultCacheSize(0);
+    EXPECT_EQ(run("lupa OR hello"), first);
+    EXPECT_FALSE(s.stats().result_cache_hit);
+    EXPECT_GT(s.stats().block_cache_hits, 0);
+    EXPECT_EQ(s.stats().block_cache_misses, 0);
+
+    // A new index is a new generation, nothing cached for the old one is used.
+    s.setResultCacheSize(defaultResultCacheBytes);
+    InvertedIndex rebuilt;
+    rebuilt.erase();
+    rebuilt.traverse("../../test");
+    EXPECT_EQ(run("lupa OR hello"), first);
+    EXPECT_FALSE(s.stats().result_cache_hit);
+    EXPECT_EQ(s.stats().block_cache_hits, 0);
+}
+
+TEST_F(SimpleSearchEngineTest, WarmupWithinBudget) {
+    ii.erase();
+    ii.traverse("../../test");
+
+    Residency postings = residency(posting_lists_p);
+    EXPECT_EQ(postings.size, IndexTelemetry::fileSize(posting_lists_p));
+    EXPECT_LE(postings.resident, postings.size);
+
+    std::stringstream log;
+    IndexWarmer everything;
+    EXPECT_EQ(everything.warm(log), postings.size);
+
+    IndexWarmer part;
+    part.setBudget(postings.size / 2);
+    int64_t warmed = part.warm(log);
+    EXPECT_GT(warmed, 0);
+    EXPECT_LE(warmed, postings.size / 2);
+}
+
+TEST_F(SimpleSearchEngineTest, ShardsMatchSingleIndex) {
+    ii.erase();
+    ii.traverse("../../test");
+
+    std::vector<fs::path> files = InvertedIndex::listDocuments("../../test");
+    std::string index_dir = fs::path(trie_p).parent_path().string();
+    ShardManifest manifest;
+    for (size_t shard = 0; shard < files.size(); ++shard) {
+        fs::create_directories(ShardManifest::shardDir(shard));
+        setIndexDir(ShardManifest::shardDir(shard));
+        InvertedIndex part;
+        part.erase();
+        part.index({files[shard]});
+        manifest.shards.push_back({static_cast<int64_t>(shard), 1, part.termsCount()});
+        setIndexDir(index_dir);
+    }
+    manifest.write();
+
+    // One coordinator for all the queries, its shards stay open between them.
+    ShardedSearch sharded;
+    for (int64_t k = 1; k <= 3; ++k) {
+        sharded.chooseK(k);
+        for (const char* query : {"pupa", "lupa OR hello", "papulya AND NOT hello", "p*"}) {
+            Search single;
+            single.chooseK(k);
+            single.printResults(false);
+            std::string input = query;
+            single.createParser(input);
+
+            sharded.search(query, false);
+
+            ASSERT_EQ(sharded.results().size(), single.results().size()) << query;
+            for (size_t i = 0; i < single.results().size(); ++i) {
+                EXPECT_EQ(sharded.results()[i].doc, single.results()[i].doc) << query;
+                EXPECT_EQ(sharded.results()[i].path, single.results()[i].path) << query;
+                EXPECT_EQ(sharded.results()[i].text, single.results()[i].text) << query;
+            }
+        }
+    }
+
+    // pupochka is missing from the first shard only and is no unknown term, pupaa is in none and is
+    // reported once.
+    sharded.printWarnings(false);
+    sharded.chooseK(3);
+    sharded.search("pupochka OR pupaa", false);
+    ASSERT_EQ(sharded.warnings().size(), 1);
+    EXPECT_EQ(sharded.warnings()[0].rfind(unknownTermWarning + "pupaa", 0), 0);
+    EXPECT_EQ(sharded.results().size(), 1);
+
+    sharded.chooseEvaluation(Evaluation::TERM_AT_A_TIME);
+    sharded.useTier(false);
+    sharded.search("lupa OR hello", false);
+    Search single;
+    single.chooseK(3);
+    single.printResults(false);
+    std::string input = "lupa OR hello";
+    single.createParser(input);
+    ASSERT_EQ(sharded.results().size(), single.results().size());
+    for (size_t i = 0; i < single.results().size(); ++i) {
+        EXPECT_EQ(sharded.results()[i].text, single.results()[i].text);
+    }
+    fs::remove_all(ShardManifest::root());
+}
+
+TEST_F(SimpleSearchEngineTest, GenerationsSwapInBackground) {
+    std::string index_dir = fs::path(trie_p).parent_path().string();
+    IndexGenerations generations(fs::path(index_dir) / "generations");
+    fs::remove_all(generations.root());
+    std::vector<fs::path> files = InvertedIndex::listDocuments("../../test");
+    auto build = [&](const std::vector<fs::path>& documents) {
+        int64_t generation = generations.next();
+        fs::create_directories(generations.dir(generation));
+        setIndexDir(generations.dir(generation));
+        InvertedIndex part;
+        part.erase();
+        part.index(documents);
+        setIndexDir(generations.root().string());
+        generations.publish(generation);
+        generations.prune();
+    };
+    auto count = [](Search& searcher) {
+        std::string input = "lupa OR hello OR pupa";
+        searcher.createParser(input);
+
+        return searcher.results().size();
+    };
+
+    build({files[0]});
+    Search searcher;
+    searcher.chooseK(10);
+    searcher.printResults(false);
+    EXPECT_EQ(searcher.generation(), 0);
+    size_t before = count(searcher);
+
+    build(files);
+    EXPECT_EQ(searcher.generation(), 1);
+    EXPECT_GT(count(searcher), before);
+    EXPECT_FALSE(searcher.reload());
+
+    // The reloader swaps the next generation in, the oldest one is removed from disk.
+    build({files[0]});
+    searcher.startReloader(std::chrono::milliseconds(1));
+    for (int i = 0; i < 1000 && searcher.reloads() == 0; ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    EXPECT_EQ(searcher.generation(), 2);
+    EXPECT_EQ(count(searcher), before);
+    searcher.stopReloader();
+    EXPECT_FALSE(fs::exists(generations.dir(0)));
+    EXPECT_TRUE(fs::exists(generations.dir(1)));
+
+    // A searcher still serving generation 2 keeps it on disk through two publishes and queries it meanwhile.
+    Search stale;
+    stale.chooseK(10);
+    stale.printResults(false);
+    stale.setResultCacheSize(0);
+    stale.setBlockCacheSize(0);
+    stale.startReloader(std::chrono::hours(1));
+    std::atomic<bool> done{false};
+    std::atomic<int64_t> queries{0};
+    std::atomic<int64_t> wrong{0};
+    std::thread querying([&] {
+        while (!done || queries == 0) {
+            wrong += count(stale) != before;
+            ++queries;
+        }
+    });
+    build(files);
+    build(files);
+    done = true;
+    querying.join();
+    EXPECT_EQ(wrong, 0);
+    EXPECT_EQ(stale.generation(), 2);
+    EXPECT_TRUE(fs::exists(generations.dir(2)));
+    EXPECT_FALSE(fs::exists(generations.dir(1)));
+
+    // Once no searcher reads it the next publish removes it.
+    stale.stopReloader();
+    EXPECT_TRUE(stale.reload());
+    EXPECT_TRUE(searcher.reload());
+    build(files);
+    EXPECT_FALSE(fs::exists(generations.dir(2)));
+    EXPECT_EQ(count(stale), count(searcher));
+
+    setIndexDir(index_dir);
+    fs::remove_all(generations.root());
+}
+
+// Starts every task on a thread of its own.
+struct ThreadExecutor {
+    std::vector<std::thread> threads;
+
+    void operator()(std::function<void()> task) {
+        threads.emplace_back(std::move(task));
+    }
+
+    void join() {
+        for (std::thread& thread : threads) {
+            thread.join();
+        }
+        threads.clear();
+    }
+};
+
+struct DetachedTask {
+    struct promise_type {
+        DetachedTask get_return_object() {
+            return {};
+        }
+        std::suspend_never initial_suspend() noexcept {
+            return {};
+        }
+        std::suspend_never final_suspend() noexcept {
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() {
+            std::terminate();
+        }
+    };
+};
+
+DetachedTask awaitQuery(Index& index, ThreadExecutor& executor, QueryResults& results) {
+    results = co_await index.awaitSearch("pupa", 3, executor);
+}
+
+TEST_F(SimpleSearchEngineTest, EmbeddedIndex) {
+    ii.erase();
+    ii.traverse("../../test");
+    std::string index_dir = fs::path(trie_p).parent_path().string();
+
+    Index missing;
+    EXPECT_FALSE(missing.open(index_dir + "/missing").empty());
+    EXPECT_FALSE(missing.isOpen());
+    EXPECT_FALSE(missing.search("pupa", 3).ok());
+
+    Index index;
+    ASSERT_EQ(index.open(index_dir), "");
+    QueryResults results = index.search("pupa", 3);
+    ASSERT_TRUE(results.ok());
+    ASSERT_FALSE(results.hits.empty());
+    for (const QueryHit& hit : results.hits) {
+        EXPECT_TRUE(fs::exists(hit.path));
+        EXPECT_FALSE(hit.lines.empty());
+        EXPECT_GT(hit.score, 0);
+    }
+
+    QueryResults malformed = index.search("for AND", 3);
+    EXPECT_EQ(malformed.error, "unexpected token in factor");
+    QueryResults unknown = index.search("pupaa", 3);
+    EXPECT_TRUE(unknown.hits.empty());
+    EXPECT_EQ(unknown.warnings.size(), 1);
+
+    ThreadExecutor executor;
+    std::vector<std::future<QueryResults> > futures;
+    for (int i = 0; i < 8; ++i) {
+        futures.push_back(index.searchAsync("pupa", 3, executor));
+    }
+    for (auto& future : futures) {
+        QueryResults async = future.get();
+        ASSERT_EQ(async.hits.size(), results.hits.size());
+        EXPECT_EQ(async.hits[0].path, results.hits[0].path);
+    }
+    QueryResults awaited;
+    awaitQuery(index, executor, awaited);
+    executor.join();
+    ASSERT_EQ(awaited.hits.size(), results.hits.size());
+    EXPECT_EQ(awaited.hits[0].doc, results.hits[0].doc);
+
+    index.close();
+    EXPECT_EQ(index.search("pupa", 3).error, "index is not open");
+}
+
+TEST_F(SimpleSearchEngineTest, SearchesShareSnapshot) {
+    ii.erase();
+    ii.traverse("../../test");
+
+    Search first;
+    first.printResults(false);
+    first.chooseK(3);
+    std::string input = "lupa OR hello";
+    first.createParser(input);
+    EXPECT_FALSE(first.stats().result_cache_hit);
+
+    std::vector<std::unique_ptr<Search> > pool;
+    for (int i = 0; i < 8; ++i) {
+        pool.emplace_back(new Search());
+        pool.back()->shareSnapshots(first.snapshots());
+        pool.back()->printResults(false);
+        pool.back()->chooseK(3);
+    }
+    std::vector<std::thread> threads;
+    for (auto& search : pool) {
+        threads.emplace_back([&search] {
+            for (const char* query : {"lupa OR hello", "pupa", "lupa OR hello"}) {
+                std::string input = query;
+                search->createParser(input);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    for (auto& search : pool) {
+        EXPECT_EQ(&search->resultCache(), &first.resultCache());
+        EXPECT_EQ(search->generation(), first.generation());
+        EXPECT_TRUE(search->stats().result_cache_hit);
+        ASSERT_EQ(search->results().size(), first.results().size());
+        for (size_t i = 0; i < first.results().size(); ++i) {
+            EXPECT_EQ(search->results()[i].path, first.results()[i].path);
+        }
+    }
+    EXPECT_EQ(first.resultCache().size(), 2);
+    EXPECT_EQ(first.resultCache().misses() + first.resultCache().hits(), 1 + 3 * pool.size());
+}
+
 int main(int argc, char** argv) {
     ::testing::InitGoogleTest(&argc, argv);
     GTEST_FLAG_SET(death_test_style, "threadsafe");
     return RUN_ALL_TESTS();
 }
+
+TEST(LatencyHistogramTest, PercentilesWithinBucketWidth) {
+    LatencyHistogram histogram;
+    for (int64_t value = 1; value <= 100000; ++value) {
+        histogram.record(value * 1000);
+    }
+    EXPECT_EQ(histogram.count(), 100000);
+    EXPECT_EQ(histogram.min(), 1000);
+    EXPECT_EQ(histogram.max(), 100000000);
+    for (double percent : {50.0, 95.0, 99.0, 99.9}) {
+        double expected = percent * 1000 * 1000;
+        EXPECT_NEAR(histogram.percentile(percent), expected, expected / LatencyHistogram::subBuckets) << percent;
+    }
+
+    LatencyHistogram other;
+    other.record(5);
+    histogram.merge(other);
+    EXPECT_EQ(histogram.min(), 5);
+    EXPECT_EQ(histogram.percentile(0), 5);
+}
+
+TEST_F(SimpleSearchEngineTest, LoadReplaysQueries) {
+    ii.erase();
+    ii.traverse("../../test");
+    std::string index_dir = fs::path(trie_p).parent_path().string();
+    Index index;
+    ASSERT_EQ(index.open(index_dir), "");
+
+    LoadOptions options;
+    options.concurrency = 3;
+    options.requests = 30;
+    LoadReport closed = runLoad(index, {"pupa", "lupa OR hello", "for AND"}, options);
+    EXPECT_EQ(closed.requests, 30);
+    EXPECT_EQ(closed.errors, 10);
+    EXPECT_LE(closed.latency.percentile(50), closed.latency.percentile(99));
+
+    std::vector<std::string> queries = zipfQueries(index_dir, 20, 2, 1.0, 7);
+    ASSERT_EQ(queries.size(), 20);
+    EXPECT_EQ(queries, zipfQueries(index_dir, 20, 2, 1.0, 7));
+    options.rate = 1000;
+    LoadReport open = runLoad(index, queries, options);
+    EXPECT_EQ(open.requests, 30);
+    EXPECT_EQ(open.errors, 0);
+    EXPECT_NE(open.toJson().find("\"mode\":\"open\""), std::string::npos);
+}
+
+TEST_F(SimpleSearchEngineTest, IndexInspection) {
+    ii.erase();
+    ii.traverse("../../test");
+    std::string index_dir = fs::path(trie_p).parent_path().string();
+
+    std::fstream trie_file(trie_p, std::ios::binary | std::ios::in);
+    trie_file.seekg(2 * sizeof(int64_t));
+    Trie trie;
+    trie.saveBackToRAM(trie_file);
+
+    IndexInspector inspector(index_dir);
+    IndexReport report = inspector.inspect(3);
+    EXPECT_EQ(report.terms, trie.termsCount());
+    EXPECT_EQ(report.trie_nodes, trie.nodesCount());
+    EXPECT_EQ(report.postings_bytes, report.df_bytes + report.did_bytes + report.bitmap_bytes + report.unreferenced_bytes);
+    EXPECT_EQ(report.unreferenced_bytes, 0);
+    EXPECT_EQ(report.did_bytes, report.postings * static_cast<int64_t>(sizeof(DID)));
+    EXPECT_LT(report.varint_did_bytes, report.did_bytes);
+    ASSERT_EQ(report.longest.size(), 3);
+    EXPECT_GE(report.longest[0].df, report.longest[2].df);
+
+    std::ostringstream dump;
+    inspector.dumpTerm("Pupa", dump);
+    EXPECT_EQ(dump.str().rfind("TERM: 'pupa' df ", 0), 0);
+    EXPECT_NE(dump.str().find("lines: "), std::string::npos);
+}
+
+TEST_F(SimpleSearchEngineTest, FirstTierMatchesFullLists) {
+    ii.erase();
+    ii.traverse("../../test");
+    TierWriter(2).run();
+
+    auto search = [](Search& search, bool tier, int64_t k, const std::string& query) {
+        search.chooseK(k);
+        search.useTier(tier);
+        search.chooseEvaluation(Evaluation::DOCUMENT_AT_A_TIME);
+        search.printResults(false);
+        search.setResultCacheSize(0);
+        std::string input = query;
+        search.createParser(input);
+    };
+
+    int64_t answered = 0;
+    int64_t fallbacks = 0;
+    for (int64_t k : {1, 3}) {
+        for (const std::string query : {"pupa", "lupa OR hello", "papulya AND NOT hello", "p* AND lupa~1"}) {
+            Search full;
+            Search tiered;
+            search(full, false, k, query);
+            search(tiered, true, k, query);
+            answered += std::string(tiered.stats().evaluation) == "tier";
+            fallbacks += tiered.stats().tier_fallback;
+            ASSERT_EQ(tiered.results().size(), full.results().size()) << query;
+            for (size_t i = 0; i < full.results().size(); ++i) {
+                EXPECT_EQ(tiered.results()[i].doc, full.results()[i].doc) << query;
+                EXPECT_EQ(tiered.results()[i].score, full.results()[i].score) << query;
+                EXPECT_EQ(tiered.results()[i].text, full.results()[i].text) << query;
+            }
+        }
+    }
+    EXPECT_GT(answered, 0);
+    EXPECT_GT(fallbacks, 0);
+}
+
+// The tier keeps the highest documents of every term. The documents the term fits best are in the middle
+// here, so the tier only answers like the full lists while the results rank by document.
+TEST_F(SimpleSearchEngineTest, FirstTierFollowsRanking) {
+    fs::path dir = fs::path(trie_p).parent_path() / "tierTest";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    for (int i = 0; i < 6; ++i) {
+        int64_t tf = i == 2 || i == 3 ? 5 : 1;
+        std::ofstream file(dir / (std::to_string(i) + ".txt"));
+        for (int j = 0; j < 6; ++j) {
+            file << (j < tf ? "zeta" : "filler") << ' ';
+        }
+    }
+    ii.erase();
+    ii.traverse(dir.string());
+    TierWriter(2).run();
+
+    auto search = [](Search& search, bool tier, int64_t k) {
+        search.chooseK(k);
+        search.useTier(tier);
+        search.printResults(false);
+        search.setResultCacheSize(0);
+        std::string input = "zeta";
+        search.createParser(input);
+    };
+
+    Search all;
+    search(all, false, 6);
+    Search full;
+    search(full, false, 2);
+    Search tiered;
+    search(tiered, true, 2);
+    ASSERT_EQ(all.results().size(), 6);
+    ASSERT_EQ(full.results().size(), 2);
+    double best = 0;
+    for (const SearchResult& result : all.results()) {
+        best = std::max(best, result.score);
+    }
+    EXPECT_LT(full.results()[0].score, best);
+    EXPECT_EQ(std::string(tiered.stats().evaluation), "tier");
+    ASSERT_EQ(tiered.results().size(), full.results().size());
+    for (size_t i = 0; i < full.results().size(); ++i) {
+        EXPECT_EQ(tiered.results()[i].doc, full.results()[i].doc);
+        EXPECT_EQ(tiered.results()[i].score, full.results()[i].score);
+    }
+    fs::remove_all(dir);
+}
+
+TEST_F(SimpleSearchEngineTest, DeduplicatesNearCopies) {
+    fs::path dir = fs::path(trie_p).parent_path() / "dedupTest";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+    std::vector<std::string> words;
+    for (int i = 0; i < 60; ++i) {
+        words.push_back(std::string{static_cast<char>('a' + i % 26), static_cast<char>('a' + i / 26), 'x'});
+    }
+    auto write = [&](const std::string& name, const std::vector<std::string>& text) {
+        std::ofstream file(dir / name);
+        for (const std::string& word : text) {
+            file << word << ' ';
+        }
+    };
+    write("a.txt", words);
+    write("b.txt", words);
+    std::vector<std::string> near = words;
+    near[30] = "changed";
+    write("c.txt", near);
+    write("d.txt", {"aax", "other", "words"});
+
+    auto query = [](int64_t k, const std::string& term = "aax") {
+        Search search;
+        search.chooseK(k);
+        search.printResults(false);
+        search.printWarnings(false);
+        search.setResultCacheSize(0);
+        std::string input = term;
+        search.createParser(input);
+
+        return search.results();
+    };
+
+    ii.erase();
+    ii.setDeduplication(0.8);
+    ii.traverse(dir.string());
+    EXPECT_EQ(ii.telemetry().docs, 2);
+    EXPECT_EQ(ii.telemetry().duplicates, 2);
+    std::vector<SearchResult> results = query(10);
+    ASSERT_EQ(results.size(), 2);
+    for (const SearchResult& result : results) {
+        if (fs::path(result.path).filename() == "d.txt") {
+            EXPECT_TRUE(result.duplicates.empty());
+            continue;
+        }
+        std::vector<std::string> copies = {fs::path(result.path).filename().string()};
+        for (const std::string& duplicate : result.duplicates) {
+            copies.push_back(fs::path(duplicate).filename().string());
+        }
+        std::sort(copies.begin(), copies.end());
+        EXPECT_EQ(copies, (std::vector<std::string>{"a.txt", "b.txt", "c.txt"}));
+        EXPECT_NE(result.text.find("duplicates:"), std::string::npos);
+    }
+
+    // The near copy differs by a term: the term of the copies left out is not found, and the copies are
+    // still listed under the indexed one, which has the other term only.
+    std::vector<SearchResult> original = query(10, words[30]);
+    std::vector<SearchResult> changed = query(10, "changed");
+    EXPECT_EQ(original.size() + changed.size(), 1);
+    for (const std::vector<SearchResult>& found : {original, changed}) {
+        if (!found.empty()) {
+            EXPECT_EQ(found[0].duplicates.size(), 2);
+        }
+    }
+
+    InvertedIndex all;
+    all.erase();
+    all.traverse(dir.string());
+    EXPECT_EQ(all.telemetry().docs, 4);
+    EXPECT_EQ(query(10).size(), 4);
+    EXPECT_EQ(query(10, words[30]).size(), 2);
+    EXPECT_EQ(query(10, "changed").size(), 1);
+    fs::remove_all(dir);
+}
+
+TEST_F(SimpleSearchEngineTest, ProgressWhileAccumulatingRuns) {
+    ii.setMemoryLimit(1);
+    ii.setProgressInterval(1e-9);
+    ii.erase();
+
+    std::stringstream buffer;
+    std::streambuf* cerrbuf = std::cerr.rdbuf(buffer.rdbuf());
+    ii.traverse("../../test");
+    std::cerr.rdbuf(cerrbuf);
+
+    std::vector<std::string> lines;
+    for (std::string line; std::getline(buffer, line);) {
+        lines.push_back(line);
+    }
+    ASSERT_EQ(lines.size(), 3);
+    // After the first document, before the merge.
+    EXPECT_EQ(lines[0].find("--progress docs 1 "), 0);
+    EXPECT_EQ(lines[0].find("vocabulary 0"), std::string::npos);
+    // The trie is built by the merge only.
+    EXPECT_NE(lines[0].find("trie nodes 0 "), std::string::npos);
+    EXPECT_EQ(lines[0].find("runs 0"), std::string::npos);
+    EXPECT_EQ(lines[0].find("runs 1 (0 B)"), std::string::npos);
+    EXPECT_NE(lines[0].find("runs 1 ("), std::string::npos);
+}
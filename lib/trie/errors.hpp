@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+// An error after which a call can not go on: a malformed query, a missing or damaged index.
+class EngineError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+inline thread_local int throw_engine_errors = 0;
+
+// While one is alive on a thread, fail() throws EngineError there instead of ending the process,
+// so a program embedding the engine gets its errors back.
+class ThrowEngineErrors {
+public:
+    ThrowEngineErrors() {
+        ++throw_engine_errors;
+    }
+
+    ~ThrowEngineErrors() {
+        --throw_engine_errors;
+    }
+
+    ThrowEngineErrors(const ThrowEngineErrors&) = delete;
+    ThrowEngineErrors& operator=(const ThrowEngineErrors&) = delete;
+};
+
+// The command line tools print the message and exit.
+[[noreturn]] inline void fail(const std::string& message) {
+    if (throw_engine_errors > 0) {
+        throw EngineError(message);
+    }
+    std::cerr << "--" << message << '\n';
+    std::exit(EXIT_FAILURE);
+}
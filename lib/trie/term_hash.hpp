@@ -0,0 +1,245 @@
+#pragma once
+#include "trie.hpp"
+
+#include <bit>
+#include <cstdint>
+#include <fstream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Minimal perfect hash of the vocabulary (BBHash): level i is a bitset of about gamma times the keys
+// still unplaced; a key whose hash lands alone on a bit of a level takes that bit, the keys that
+// collide move on to the next level. The ordinal of a term is the rank of its bit over all levels,
+// so the terms get the dense ordinals 0 .. n-1 and a lookup costs a hash and one or two bitset words.
+//
+// Every ordinal keeps a fingerprint of its term, so a term outside the vocabulary, which still lands
+// on some bit, is rejected. The trie is only needed to enumerate terms for wildcards and fuzzy terms.
+//
+// File format: int64 terms count, int64 levels count, per level int64 words count and the words,
+// int64 count of the terms left after the last level, per such term int64 length, its bytes and
+// int64 posting_list_pos, then per ordinal uint64 fingerprint and int64 posting_list_pos.
+class TermHash {
+public:
+    static constexpr double gamma = 2.0;
+    static constexpr int64_t maxLevels = 32;
+
+    TermHash() : size_(0) {}
+
+    void build(const std::vector<TermMatch>& terms) {
+        levels_.clear();
+        ranks_.clear();
+        leftover_.clear();
+        size_ = terms.size();
+
+        std::vector<uint64_t> hashes(terms.size());
+        for (size_t i = 0; i < terms.size(); ++i) {
+            hashes[i] = hash(terms[i].term);
+        }
+        std::vector<uint32_t> keys(terms.size());
+        for (size_t i = 0; i < keys.size(); ++i) {
+            keys[i] = i;
+        }
+
+        std::vector<std::pair<int64_t, int64_t> > placed;
+        while (!keys.empty() && static_cast<int64_t>(levels_.size()) < maxLevels) {
+            int64_t level = levels_.size();
+            int64_t words = (static_cast<int64_t>(keys.size() * gamma) + 63) / 64;
+            std::vector<uint64_t> seen(words, 0);
+            std::vector<uint64_t> collided(words, 0);
+            for (uint32_t key : keys) {
+                uint64_t bit = position(hashes[key], level, words);
+                uint64_t mask = uint64_t(1) << (bit & 63);
+                if (seen[bit >> 6] & mask) {
+                    collided[bit >> 6] |= mask;
+                }
+                seen[bit >> 6] |= mask;
+            }
+
+            std::vector<uint32_t> rest;
+            for (uint32_t key : keys) {
+                uint64_t bit = position(hashes[key], level, words);
+                if (collided[bit >> 6] & (uint64_t(1) << (bit & 63))) {
+                    rest.push_back(key);
+                } else {
+                    placed.push_back({level, key});
+                }
+            }
+            for (int64_t w = 0; w < words; ++w) {
+                seen[w] &= ~collided[w];
+            }
+            levels_.push_back(std::move(seen));
+            keys.swap(rest);
+        }
+        computeRanks();
+
+        entries_.assign(size_, {});
+        for (const auto& [level, key] : placed) {
+            int64_t ord = ordinalAt(hashes[key], level);
+            entries_[ord] = {fingerprint(terms[key].term), terms[key].posting_list_pos};
+        }
+        for (uint32_t key : keys) {
+            leftover_.push_back({terms[key].term, terms[key].posting_list_pos, 0});
+            entries_[size_ - keys.size() + leftover_.size() - 1] = {fingerprint(terms[key].term), terms[key].posting_list_pos};
+        }
+    }
+
+    int64_t size() const {
+        return size_;
+    }
+
+    // Dense ordinal of the term in 0 .. size() - 1, -1 when it is not in the vocabulary.
+    int64_t ordinal(std::string_view term) const {
+        uint64_t h = hash(term);
+        for (size_t level = 0; level < levels_.size(); ++level) {
+            int64_t words = levels_[level].size();
+            uint64_t bit = position(h, level, words);
+            if (levels_[level][bit >> 6] & (uint64_t(1) << (bit & 63))) {
+                int64_t ord = ordinalAt(h, level);
+                return entries_[ord].fingerprint == fingerprint(term) ? ord : -1;
+            }
+        }
+        for (size_t i = 0; i < leftover_.size(); ++i) {
+            if (leftover_[i].term == term) {
+                return size_ - leftover_.size() + i;
+            }
+        }
+
+        return -1;
+    }
+
+    // Same result as Trie::find.
+    int64_t find(std::string_view term) const {
+        int64_t ord = ordinal(term);
+
+        return ord == -1 ? -1 : entries_[ord].posting_list_pos;
+    }
+
+    // Bits of the levels per term, about 3.7 with gamma 2.
+    double bitsPerTerm() const {
+        int64_t bits = 0;
+        for (const auto& level : levels_) {
+            bits += level.size() * 64;
+        }
+
+        return size_ ? static_cast<double>(bits) / size_ : 0;
+    }
+
+    void write(std::ostream& out) const {
+        writeInt(out, size_);
+        writeInt(out, levels_.size());
+        for (const auto& level : levels_) {
+            writeInt(out, level.size());
+            out.write(reinterpret_cast<const char*>(level.data()), level.size() * sizeof(uint64_t));
+        }
+        writeInt(out, leftover_.size());
+        for (const TermMatch& term : leftover_) {
+            writeInt(out, term.term.size());
+            out.write(term.term.data(), term.term.size());
+            writeInt(out, term.posting_list_pos);
+        }
+        out.write(reinterpret_cast<const char*>(entries_.data()), entries_.size() * sizeof(Entry));
+    }
+
+    // False when the file is missing or truncated, an index written before the hash existed.
+    bool read(std::istream& in) {
+        size_ = readInt(in);
+        levels_.resize(std::max<int64_t>(0, readInt(in)));
+        for (auto& level : levels_) {
+            level.resize(std::max<int64_t>(0, readInt(in)));
+            in.read(reinterpret_cast<char*>(level.data()), level.size() * sizeof(uint64_t));
+        }
+        leftover_.resize(std::max<int64_t>(0, readInt(in)));
+        for (TermMatch& term : leftover_) {
+            term.term.resize(std::max<int64_t>(0, readInt(in)));
+            in.read(term.term.data(), term.term.size());
+            term.posting_list_pos = readInt(in);
+        }
+        entries_.resize(std::max<int64_t>(0, size_));
+        in.read(reinterpret_cast<char*>(entries_.data()), entries_.size() * sizeof(Entry));
+        computeRanks();
+
+        return static_cast<bool>(in);
+    }
+
+    // Writes the hash of every term of the trie to term_hash_p.
+    static void save(Trie& trie) {
+        std::vector<TermMatch> terms;
+        trie.match("*", std::numeric_limits<size_t>::max(), terms);
+        TermHash hash;
+        hash.build(terms);
+
+        std::ofstream out(term_hash_p, std::ios::binary | std::ios::trunc);
+        hash.write(out);
+    }
+
+private:
+    struct Entry {
+        uint64_t fingerprint;
+        int64_t posting_list_pos;
+    };
+
+    int64_t size_;
+    std::vector<std::vector<uint64_t> > levels_;
+    // Ones before every word of every level, counted from the first level.
+    std::vector<std::vector<int64_t> > ranks_;
+    std::vector<TermMatch> leftover_;
+    std::vector<Entry> entries_;
+
+    // FNV-1a finished by the splitmix64 mixer.
+    static uint64_t hash(std::string_view term) {
+        uint64_t h = 14695981039346656037ull;
+        for (char c : term) {
+            h = (h ^ static_cast<unsigned char>(c)) * 1099511628211ull;
+        }
+
+        return mix(h);
+    }
+
+    static uint64_t fingerprint(std::string_view term) {
+        return mix(hash(term) ^ 0x9e3779b97f4a7c15ull);
+    }
+
+    static uint64_t mix(uint64_t x) {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+
+        return x ^ (x >> 31);
+    }
+
+    static uint64_t position(uint64_t h, int64_t level, int64_t words) {
+        return mix(h + level * 0x9e3779b97f4a7c15ull) % (words * 64);
+    }
+
+    int64_t ordinalAt(uint64_t h, int64_t level) const {
+        const auto& bits = levels_[level];
+        uint64_t bit = position(h, level, bits.size());
+        uint64_t below = bits[bit >> 6] & ((uint64_t(1) << (bit & 63)) - 1);
+
+        return ranks_[level][bit >> 6] + std::popcount(below);
+    }
+
+    void computeRanks() {
+        ranks_.resize(levels_.size());
+        int64_t total = 0;
+        for (size_t level = 0; level < levels_.size(); ++level) {
+            ranks_[level].resize(levels_[level].size());
+            for (size_t w = 0; w < levels_[level].size(); ++w) {
+                ranks_[level][w] = total;
+                total += std::popcount(levels_[level][w]);
+            }
+        }
+    }
+
+    static void writeInt(std::ostream& out, int64_t value) {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(int64_t));
+    }
+
+    static int64_t readInt(std::istream& in) {
+        int64_t value = 0;
+        in.read(reinterpret_cast<char*>(&value), sizeof(int64_t));
+
+        return value;
+    }
+};
@@ -4,3 +4,31 @@ const char* files_paths_p = "../trash/files.txt";
 const char* posting_lists_p = "../trash/postinglists.txt";
 const char* trie_p = "../trash/trie.txt";
 const char* line_nums_p = "../trash/numbersOfLines.txt";
+const char* line_offsets_p = "../trash/lineOffsets.txt";
+const char* term_hash_p = "../trash/termHash.txt";
+const char* analyzer_p = "../trash/analyzer.txt";
+const char* tier_p = "../trash/tier.txt";
+const char* duplicates_p = "../trash/duplicates.txt";
+
+void setIndexDir(const std::string& dir) {
+    static std::string paths[9];
+    paths[0] = dir + "/files.txt";
+    paths[1] = dir + "/postinglists.txt";
+    paths[2] = dir + "/trie.txt";
+    paths[3] = dir + "/numbersOfLines.txt";
+    paths[4] = dir + "/lineOffsets.txt";
+    paths[5] = dir + "/termHash.txt";
+    paths[6] = dir + "/analyzer.txt";
+    paths[7] = dir + "/tier.txt";
+    paths[8] = dir + "/duplicates.txt";
+
+    files_paths_p = paths[0].c_str();
+    posting_lists_p = paths[1].c_str();
+    trie_p = paths[2].c_str();
+    line_nums_p = paths[3].c_str();
+    line_offsets_p = paths[4].c_str();
+    term_hash_p = paths[5].c_str();
+    analyzer_p = paths[6].c_str();
+    tier_p = paths[7].c_str();
+    duplicates_p = paths[8].c_str();
+}
@@ -1,40 +1,55 @@
 #pragma once
+#include <algorithm>
 #include <iostream>
 #include <vector>
 #include <fstream>
-#include <set>
+#include <string>
 
 extern const char* files_paths_p;
 extern const char* posting_lists_p;
 extern const char* trie_p;
 extern const char* line_nums_p;
-
-const int postingListSizeof = 4096;
+extern const char* line_offsets_p;
+extern const char* term_hash_p;
+extern const char* analyzer_p;
+extern const char* tier_p;
+extern const char* duplicates_p;
+
+// Points the index files above into dir, "../trash" by default.
+void setIndexDir(const std::string& dir);
+
+// A term of the dictionary found by a pattern, distance is the edit distance for fuzzy lookups.
+struct TermMatch {
+    std::string term;
+    int64_t posting_list_pos;
+    int64_t distance;
+};
 
 struct TrieNode {
     char symbol;
     int64_t posting_list_pos;
     int64_t line_nums_pos;
     std::vector<TrieNode*> children;
-    std::set<int64_t> set_nums_of_lines;
 
     TrieNode() : posting_list_pos(-1), line_nums_pos(-1) {}
     TrieNode(char s) : symbol(s), posting_list_pos(-1), line_nums_pos(-1) {}
 
-    void eraseset() {
-        set_nums_of_lines.clear();
+    ~TrieNode() {
+        for (TrieNode* child : children) {
+            delete child;
+        }
     }
 };
 
 class Trie {
 public:
-    Trie() : root_(new TrieNode()) {}
+    Trie() : root_(new TrieNode()), nodes_count_(1), terms_count_(0) {}
 
     ~Trie() {
         delete root_;
     }
 
-    int64_t insert(std::string& term, std::fstream& posting_lists, int64_t& num_of_line) {
+    void insert(const std::string& term, int64_t posting_list_pos) {
         TrieNode* node = root_;
         bool flag = false;
 
@@ -48,31 +63,24 @@ public:
                 }
             }
             if (!flag) {
+                // Children are kept sorted by symbol, in the byte order of std::string, so the walks visit
+                // the terms in lexicographic order whatever the order they were inserted in.
                 TrieNode* child = new TrieNode(std::tolower(c));
-                node->children.push_back(child);
+                auto at = std::lower_bound(node->children.begin(), node->children.end(), child,
+                                           [](const TrieNode* a, const TrieNode* b) {
+                                               return static_cast<unsigned char>(a->symbol) <
+                                                      static_cast<unsigned char>(b->symbol);
+                                           });
+                node->children.insert(at, child);
                 node = child;
+                ++nodes_count_;
             }
         }
 
-        node->set_nums_of_lines.insert(num_of_line);
-        node->line_nums_pos = 0;
         if (node->posting_list_pos == -1) {
-
-            posting_lists.seekp(0, std::ios::end);
-            node->posting_list_pos = posting_lists.tellp();
-
-            int64_t posting_list_size = 0;
-            posting_lists.write(reinterpret_cast<char*>(&posting_list_size), sizeof(int64_t));
-
-            char* posting_list = new char[postingListSizeof];
-            for (int64_t i = 0; i < postingListSizeof; ++i) {
-                posting_list[i] = 0;
-            }
-            posting_lists.write(posting_list, postingListSizeof);
-            delete[] posting_list;
-
+            ++terms_count_;
         }
-        return node->posting_list_pos;
+        node->posting_list_pos = posting_list_pos;
     }
 
     int64_t find(std::string term) {
@@ -94,33 +102,136 @@ public:
         return node->posting_list_pos;
     }
 
+    // Terms matching pattern, where '*' stands for any sequence of letters, in lexicographic order.
+    // Only the part before the first '*' narrows the walk, stops after limit terms.
+    void match(const std::string& pattern, size_t limit, std::vector<TermMatch>& terms) {
+        std::string prefix = pattern.substr(0, pattern.find('*'));
+        TrieNode* node = root_;
+        for (char c : prefix) {
+            TrieNode* next = nullptr;
+            for (TrieNode* i : node->children) {
+                if (i->symbol == c) {
+                    next = i;
+                    break;
+                }
+            }
+            if (!next) {
+                return;
+            }
+            node = next;
+        }
+
+        matchhelp(node, prefix, pattern, limit, terms);
+    }
+
+    // Terms within max_distance edits (insertions, deletions, substitutions) of term. The trie is walked
+    // with one row of the Levenshtein matrix per node, a subtree is skipped once no cell of the row is
+    // within max_distance, so only the terms close to the query are visited.
+    void fuzzy(const std::string& term, int64_t max_distance, std::vector<TermMatch>& terms) {
+        std::vector<int64_t> row(term.size() + 1);
+        for (size_t i = 0; i < row.size(); ++i) {
+            row[i] = i;
+        }
+        if (root_->posting_list_pos != -1 && row.back() <= max_distance) {
+            terms.push_back({"", root_->posting_list_pos, row.back()});
+        }
+
+        std::string currentWord;
+        for (TrieNode* child : root_->children) {
+            fuzzyhelp(child, currentWord, term, max_distance, row, terms);
+        }
+    }
+
+    int64_t nodesCount() const {
+        return nodes_count_;
+    }
+
+    int64_t termsCount() const {
+        return terms_count_;
+    }
+
     void saveTrieInFile(std::fstream& trie_file) {
         save(root_, trie_file);
     }
 
     Trie* saveBackToRAM(std::fstream& trie_file) {
+        delete root_;
+        nodes_count_ = 0;
+        terms_count_ = 0;
         root_ = toRAM(trie_file);
         return this;
     }
 
-    void writelinesinfile(int64_t& file_id) {
-        std::fstream line_nums;
-        line_nums.open(line_nums_p, std::ios::binary | std::ios::in | std::ios::out);
+private:
+    TrieNode* root_;
+    int64_t nodes_count_;
+    int64_t terms_count_;
+
+    static bool globMatch(const std::string& pattern, const std::string& term) {
+        size_t p = 0;
+        size_t t = 0;
+        size_t star = std::string::npos;
+        size_t resume = 0;
+        while (t < term.size()) {
+            if (p < pattern.size() && pattern[p] == '*') {
+                star = p++;
+                resume = t;
+            } else if (p < pattern.size() && pattern[p] == term[t]) {
+                ++p;
+                ++t;
+            } else if (star != std::string::npos) {
+                p = star + 1;
+                t = ++resume;
+            } else {
+                return false;
+            }
+        }
+        while (p < pattern.size() && pattern[p] == '*') {
+            ++p;
+        }
 
-        std::fstream posting_lists;
-        posting_lists.open(posting_lists_p, std::ios::binary | std::ios::in | std::ios::out);
+        return p == pattern.size();
+    }
 
-        std::string currentWord;
-        posting_lists.seekg(0);
-        writelinesinfilehelp(root_, currentWord, line_nums, file_id, posting_lists);
-        posting_lists.seekg(0);
+    void matchhelp(TrieNode* node, std::string& currentWord, const std::string& pattern, size_t limit,
+                   std::vector<TermMatch>& terms) {
+        if (terms.size() >= limit) {
+            return;
+        }
+        if (node->posting_list_pos != -1 && globMatch(pattern, currentWord)) {
+            terms.push_back({currentWord, node->posting_list_pos, 0});
+        }
 
-        line_nums.close();
-        posting_lists.close();
+        for (TrieNode* child : node->children) {
+            currentWord.push_back(child->symbol);
+            matchhelp(child, currentWord, pattern, limit, terms);
+            currentWord.pop_back();
+        }
     }
 
-private:
-    TrieNode* root_;
+    void fuzzyhelp(TrieNode* node, std::string& currentWord, const std::string& term, int64_t max_distance,
+                   const std::vector<int64_t>& previous, std::vector<TermMatch>& terms) {
+        currentWord.push_back(node->symbol);
+
+        std::vector<int64_t> row(previous.size());
+        row[0] = previous[0] + 1;
+        int64_t best = row[0];
+        for (size_t i = 1; i < row.size(); ++i) {
+            row[i] = std::min({row[i - 1] + 1, previous[i] + 1, previous[i - 1] + (term[i - 1] != node->symbol)});
+            best = std::min(best, row[i]);
+        }
+
+        if (node->posting_list_pos != -1 && row.back() <= max_distance) {
+            terms.push_back({currentWord, node->posting_list_pos, row.back()});
+        }
+        if (best <= max_distance) {
+            for (TrieNode* child : node->children) {
+                fuzzyhelp(child, currentWord, term, max_distance, row, terms);
+            }
+        }
+
+        currentWord.pop_back();
+    }
 
     void save(const TrieNode* node, std::fstream& trie_file) {
         if (!node) return;
@@ -132,12 +243,6 @@ private:
         size_t children_count = node->children.size();
         trie_file.write(reinterpret_cast<const char*>(&children_count), sizeof(size_t));
 
-        size_t set_size = node->set_nums_of_lines.size();
-        trie_file.write(reinterpret_cast<const char*>(&set_size), sizeof(size_t));
-        for (const int64_t& line_num : node->set_nums_of_lines) {
-            trie_file.write(reinterpret_cast<const char*>(&line_num), sizeof(int64_t));
-        }
-
         for (TrieNode* child : node->children) {
             save(child, trie_file);
         }
@@ -156,74 +261,18 @@ private:
         trie_file.read(reinterpret_cast<char*>(&children_count), sizeof(size_t));
 
         TrieNode* node = new TrieNode(symbol);
+        ++nodes_count_;
+        if (posting_list_pos != -1) {
+            ++terms_count_;
+        }
         node->posting_list_pos = posting_list_pos;
         node->line_nums_pos = line_nums_pos;
         node->children.resize(children_count);
 
-
-        size_t set_size;
-        trie_file.read(reinterpret_cast<char*>(&set_size), sizeof(size_t));
-        for (size_t i = 0; i < set_size; ++i) {
-            int64_t line_num;
-            trie_file.read(reinterpret_cast<char*>(&line_num), sizeof(int64_t));
-            node->set_nums_of_lines.insert(line_num);
-        }
-
         for (size_t i = 0; i < children_count; ++i) {
             node->children[i] = toRAM(trie_file);
         }
 
         return node;
     }
-
-    void writelinesinfilehelp(TrieNode* node, std::string& currentWord, std::fstream& line_nums, int64_t& file_id, std::fstream& posting_lists) {
-        if (!node) return;
-
-        if (node->line_nums_pos != -1) {
-
-            line_nums.seekp(0, std::ios::end);
-
-            int64_t pos_of_lines = line_nums.tellg();
-
-
-            posting_lists.seekg(node->posting_list_pos);
-            int64_t df;
-            posting_lists.read(reinterpret_cast<char*>(&df), sizeof(int64_t));
-
-            int64_t dId_ind;
-            int64_t cur_pos;
-            for (int64_t i = 0; i < df; ++i) {
-                posting_lists.seekp(node->posting_list_pos + sizeof(int64_t) + i * (40));
-                posting_lists.read(reinterpret_cast<char*>(&dId_ind), sizeof(int64_t));
-                if (dId_ind == file_id) {
-                    cur_pos = posting_lists.tellg();
-                    posting_lists.seekg(cur_pos + 3 * sizeof(int64_t));
-                    posting_lists.write(reinterpret_cast<char*>(&pos_of_lines), sizeof(int64_t));
-
-                    break;
-                }
-            }
-
-
-            line_nums.seekp(pos_of_lines);
-
-            int64_t line_nums_count = node->set_nums_of_lines.size();
-            line_nums.write(reinterpret_cast<char*>(&line_nums_count), sizeof(int64_t));
-
-            for (int64_t i : node->set_nums_of_lines) {
-                line_nums.write(reinterpret_cast<char*>(&i), sizeof(int64_t));
-            }
-
-            node->eraseset();
-            node->line_nums_pos = -1;
-        }
-
-        for (TrieNode* child : node->children) {
-            if (child) {
-                currentWord.push_back(child->symbol);
-                writelinesinfilehelp(child, currentWord, line_nums, file_id, posting_lists);
-                currentWord.pop_back();
-            }
-        }
-    }
 };
@@ -0,0 +1,36 @@
+#include "../index/generations.hpp"
+#include "warmup.hpp"
+
+int main(int argc, char* argv[]) {
+    setIndexDir(IndexGenerations::fromIndexDir().currentDir());
+    IndexWarmer warmer;
+    bool warm = true;
+    bool lock = false;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--budget" && i + 1 < argc) {
+            warmer.setBudget(parseSize(argv[++i]));
+        } else if (arg == "--queries" && i + 1 < argc) {
+            warmer.addQueryLog(argv[++i]);
+        } else if (arg == "--lock") {
+            lock = true;
+            warmer.lockInMemory(true);
+        } else if (arg == "--report") {
+            warm = false;
+        } else {
+            std::cerr << "--unknown option: " << arg << '\n';
+            std::exit(EXIT_FAILURE);
+        }
+    }
+
+    if (warm) {
+        warmer.warm(std::cerr);
+    }
+    std::cout << residencyReport();
+
+    if (warm && lock) {
+        std::cerr << "--holding the index in memory until interrupted" << '\n';
+        pause();
+    }
+}
@@ -0,0 +1,221 @@
+#pragma once
+#include "../index/analyzer.hpp"
+#include "../index/telemetry.hpp"
+#include "../trie/trie.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct Residency {
+    int64_t size = 0;
+    int64_t resident = 0;
+};
+
+// How much of the file is in the page cache, by mincore over a mapping of it.
+inline Residency residency(const char* path) {
+    Residency rez;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return rez;
+    }
+    struct stat st{};
+    fstat(fd, &st);
+    rez.size = st.st_size;
+    if (rez.size > 0) {
+        void* map = mmap(nullptr, rez.size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map != MAP_FAILED) {
+            int64_t page = sysconf(_SC_PAGESIZE);
+            std::vector<unsigned char> pages((rez.size + page - 1) / page);
+            if (mincore(map, rez.size, pages.data()) == 0) {
+                for (size_t i = 0; i < pages.size(); ++i) {
+                    if (pages[i] & 1) {
+                        rez.resident += std::min(page, rez.size - static_cast<int64_t>(i) * page);
+                    }
+                }
+            }
+            munmap(map, rez.size);
+        }
+    }
+    close(fd);
+
+    return rez;
+}
+
+inline std::string residencyReport() {
+    std::ostringstream out;
+    for (const IndexFileSize& file : index_files) {
+        Residency r = residency(*file.path);
+        out << std::left << std::setw(16) << file.name << std::right << std::setw(10) << IndexTelemetry::human(r.resident)
+            << " of " << std::setw(10) << IndexTelemetry::human(r.size) << " resident (" << std::fixed << std::setprecision(1)
+            << (r.size ? 100.0 * r.resident / r.size : 100.0) << "%)\n";
+    }
+
+    return out.str();
+}
+
+// Brings a cold index into the page cache: the whole dictionary and paths, then the posting lists of
+// the terms of a query log by frequency and of the most frequent terms of the index, until the
+// budget of posting bytes is spent. Reads are only advised (POSIX_FADV_WILLNEED), so they run as
+// kernel readahead; with lockInMemory the ranges are mapped and mlock'ed for the life of the warmer.
+class IndexWarmer {
+public:
+    IndexWarmer() : budget_(256 << 20), lock_(false), postings_map_(MAP_FAILED), postings_size_(0) {}
+
+    ~IndexWarmer() {
+        if (postings_map_ != MAP_FAILED) {
+            munmap(postings_map_, postings_size_);
+        }
+    }
+
+    void setBudget(int64_t bytes) {
+        budget_ = bytes;
+    }
+
+    void lockInMemory(bool lock) {
+        lock_ = lock;
+    }
+
+    // A query per line as given to ./search, the terms are counted to warm the frequent ones first.
+    void addQueryLog(const std::string& path) {
+        std::ifstream log(path);
+        if (!log) {
+            std::cerr << "--can not open the query log: " << path << '\n';
+            std::exit(EXIT_FAILURE);
+        }
+        Analyzer analyzer(AnalyzerOptions::load());
+        std::string query;
+        std::string term;
+        while (std::getline(log, query)) {
+            size_t pos = 0;
+            std::string_view token;
+            while (Analyzer::nextToken(query, pos, token)) {
+                if (token != "AND" && token != "OR" && token != "NOT" && analyzer.analyze(token, term)) {
+                    ++query_terms_[term];
+                }
+            }
+        }
+    }
+
+    // Returns the number of posting bytes warmed.
+    int64_t warm(std::ostream& log) {
+        adviseWhole(trie_p);
+        adviseWhole(files_paths_p);
+        adviseWhole(term_hash_p);
+
+        Trie trie;
+        std::fstream trie_tree;
+        trie_tree.open(trie_p, std::ios::binary | std::ios::in);
+        int64_t header[2];
+        trie_tree.read(reinterpret_cast<char*>(header), sizeof(header));
+        if (!trie_tree) {
+            std::cerr << "--index is empty, run ./index first" << '\n';
+            std::exit(EXIT_FAILURE);
+        }
+        trie.saveBackToRAM(trie_tree);
+        trie_tree.close();
+
+        int fd = open(posting_lists_p, O_RDONLY);
+        struct stat st{};
+        fstat(fd, &st);
+        postings_size_ = st.st_size;
+
+        // Lists are written one after another, so a list ends where the next one begins.
+        std::vector<TermMatch> terms;
+        trie.match("*", std::numeric_limits<size_t>::max(), terms);
+        std::vector<int64_t> starts;
+        for (const TermMatch& term : terms) {
+            starts.push_back(term.posting_list_pos);
+        }
+        std::sort(starts.begin(), starts.end());
+        auto extent = [&](int64_t pos) {
+            auto next = std::upper_bound(starts.begin(), starts.end(), pos);
+            return (next == starts.end() ? postings_size_ : *next) - pos;
+        };
+
+        std::vector<std::pair<int64_t, int64_t> > hot;
+        for (const TermMatch& term : terms) {
+            auto it = query_terms_.find(term.term);
+            hot.push_back({it == query_terms_.end() ? 0 : it->second, term.posting_list_pos});
+        }
+        std::sort(hot.begin(), hot.end(), [&extent](const std::pair<int64_t, int64_t>& a, const std::pair<int64_t, int64_t>& b) {
+            if (a.first != b.first) {
+                return a.first > b.first;
+            }
+            return extent(a.second) > extent(b.second);
+        });
+
+        std::vector<std::pair<int64_t, int64_t> > ranges;
+        int64_t warmed = 0;
+        int64_t lists = 0;
+        for (const auto& [count, pos] : hot) {
+            int64_t size = extent(pos);
+            if (warmed + size > budget_) {
+                continue;
+            }
+            ranges.push_back({pos, size});
+            warmed += size;
+            ++lists;
+        }
+
+        std::sort(ranges.begin(), ranges.end());
+        std::vector<std::pair<int64_t, int64_t> > merged;
+        for (const auto& range : ranges) {
+            if (!merged.empty() && merged.back().first + merged.back().second == range.first) {
+                merged.back().second += range.second;
+            } else {
+                merged.push_back(range);
+            }
+        }
+
+        if (lock_ && postings_size_ > 0) {
+            postings_map_ = mmap(nullptr, postings_size_, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        int64_t page = sysconf(_SC_PAGESIZE);
+        for (const auto& [offset, size] : merged) {
+            posix_fadvise(fd, offset, size, POSIX_FADV_WILLNEED);
+            if (postings_map_ != MAP_FAILED) {
+                int64_t begin = offset / page * page;
+                if (mlock(static_cast<char*>(postings_map_) + begin, offset + size - begin) != 0) {
+                    std::cerr << "--mlock failed, raise RLIMIT_MEMLOCK to lock the index" << '\n';
+                    munmap(postings_map_, postings_size_);
+                    postings_map_ = MAP_FAILED;
+                }
+            }
+        }
+        close(fd);
+
+        log << "--warmed " << lists << " of " << terms.size() << " posting lists, " << IndexTelemetry::human(warmed)
+            << " of " << IndexTelemetry::human(postings_size_) << (postings_map_ != MAP_FAILED ? ", locked" : "") << '\n';
+
+        return warmed;
+    }
+
+private:
+    int64_t budget_;
+    bool lock_;
+    std::unordered_map<std::string, int64_t> query_terms_;
+    void* postings_map_;
+    int64_t postings_size_;
+
+    static void adviseWhole(const char* path) {
+        int fd = open(path, O_RDONLY);
+        if (fd >= 0) {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+            close(fd);
+        }
+    }
+};